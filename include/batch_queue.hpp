@@ -0,0 +1,90 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file batch_queue.hpp
+ * \brief dynamic batching request queue for online serving
+ */
+
+#ifndef DET_BATCH_QUEUE_HPP_
+#define DET_BATCH_QUEUE_HPP_
+
+#include "detector.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace det {
+/*!
+ * \brief Collects single image requests into batches in front of a Detector.
+ * A batch is dispatched when it reaches the current target size, or when the
+ * oldest request has waited max_wait. The target size adapts to load: it
+ * grows when batches fill up and shrinks to the observed arrival count when
+ * the window expires first, so light traffic does not pay the full wait.
+ */
+class BatchQueue {
+ public:
+  /*!
+   * \brief BatchQueue Constructor, starts the dispatch thread
+   * \param detector Detector to run, must outlive the queue
+   * \param max_batch Largest batch to run in one go
+   * \param max_wait_us Max time in microseconds a request waits for batch mates
+   */
+  BatchQueue(Detector &detector, unsigned int max_batch = 8,
+             unsigned int max_wait_us = 5000);
+
+  /*!
+   * \brief ~BatchQueue Finish pending requests and stop dispatch thread
+   */
+  ~BatchQueue();
+
+  /*!
+   * \brief submit Queue a decoded image, larger ones are scaled to input size
+   * first so queued frames stay small
+   * \param image Gray, RGB or RGBA image
+   * \return Future of detections
+   */
+  std::future<std::vector<float>> submit(zz::Image image);
+
+  /*!
+   * \brief submit Decode image file on the calling thread and queue it
+   * \param in_img Image file
+   * \return Future of detections
+   */
+  std::future<std::vector<float>> submit(std::string in_img);
+
+  /*!
+   * \brief batch_size Current adaptive target batch size
+   */
+  unsigned int batch_size() const;
+
+  std::size_t num_batches() const;
+  std::size_t num_requests() const;
+
+ private:
+  struct Request {
+    zz::Image image;
+    std::promise<std::vector<float>> promise;
+    std::chrono::steady_clock::time_point arrival;
+  };
+
+  void run();
+  void dispatch(std::vector<Request> &batch);
+
+  Detector &detector_;
+  unsigned int max_batch_;
+  std::chrono::microseconds max_wait_;
+  unsigned int target_;
+  float avg_collected_;  // moving average of requests per batch
+  std::size_t num_batches_;
+  std::size_t num_requests_;
+  std::deque<Request> queue_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_;
+  std::thread thread_;
+};  // class BatchQueue
+}  // namespace det
+
+#endif  // DET_BATCH_QUEUE_HPP_
@@ -0,0 +1,41 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file box_merge.hpp
+ * \brief merging of overlapping detections from several passes
+ */
+
+#ifndef DET_BOX_MERGE_HPP_
+#define DET_BOX_MERGE_HPP_
+
+#include <vector>
+
+namespace det {
+/*!
+ * \brief How detections of the same object from several passes are merged.
+ * nms keeps the best scored box of overlapping ones, wbf averages their
+ * coordinates weighted by score (weighted box fusion).
+ */
+enum class MergeMode { nms, wbf };
+
+/*!
+ * \brief box_iou Intersection over union of two boxes
+ * \param a xmin, ymin, xmax, ymax
+ * \param b xmin, ymin, xmax, ymax
+ */
+float box_iou(const float *a, const float *b);
+
+/*!
+ * \brief merge_detections Merge detections of several passes over the same
+ * image, e.g. augmented variants or pyramid levels. Boxes overlap when their
+ * IoU exceeds iou_thresh and they share a class.
+ * \param passes Detections per pass, [id, score, xmin, ymin, xmax, ymax] * N,
+ * entries with negative id are skipped
+ * \param mode Merge mode
+ * \param iou_thresh Overlap threshold
+ * \return Merged detections sorted by descending score
+ */
+std::vector<float> merge_detections(const std::vector<std::vector<float>> &passes,
+                                    MergeMode mode, float iou_thresh);
+}  // namespace det
+
+#endif  // DET_BOX_MERGE_HPP_
@@ -0,0 +1,100 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file cascade.hpp
+ * \brief two stage detection, a cheap model gating an expensive one
+ */
+
+#ifndef DET_CASCADE_HPP_
+#define DET_CASCADE_HPP_
+
+#include "detector.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace det {
+/*!
+ * \brief Gating of the second cascade stage
+ */
+struct CascadeConfig {
+  CascadeConfig() : gate_thresh(0.3f), crops(true), context(0.5f), max_crops(8),
+    max_crop_area(0.5f), iou_thresh(0.45f) {}
+
+  float gate_thresh;  // first stage detections scoring at least this are candidates
+  bool crops;  // second stage on crops around candidates, else on the whole frame
+  float context;  // crops grow by this fraction of the candidate size on each side
+  unsigned int max_crops;  // frames with more crops run whole instead
+  float max_crop_area;  // frames with crops covering more than this fraction run whole
+  float iou_thresh;  // second stage boxes of overlapping crops are merged by nms
+};
+
+/*!
+ * \brief Runs a small, fast detector on every frame and a large, accurate one
+ * only where the first found candidates. Frames without candidates return no
+ * detections, otherwise the result is the second stage's only. Candidates are
+ * grown by context, shaped to the second stage's input aspect and joined when
+ * they overlap; crops of all frames of a batch share batched forwards. Both
+ * models must share class ids. The second stage runs without augmentation.
+ */
+class Cascade {
+ public:
+  /*!
+   * \brief Cascade Constructor
+   * \param first Cheap detector, runs on all frames, must outlive the cascade
+   * \param second Expensive detector, must outlive the cascade
+   * \param config Gating
+   */
+  Cascade(Detector &first, Detector &second,
+          const CascadeConfig &config = CascadeConfig());
+
+  /*!
+   * \brief detect Detect in image file. The first stage decodes at its input
+   * size, the full image is decoded only for frames passing the gate.
+   * \param in_img Image file
+   * \return Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   */
+  std::vector<float> detect(std::string in_img);
+
+  /*!
+   * \brief detect Detect on decoded pixels, gray, RGB or RGBA
+   * \param frame Input view, crops are resampled from it in place
+   * \return Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   */
+  std::vector<float> detect(const zz::ImageView<unsigned char> &frame);
+
+  /*!
+   * \brief detect_batch Detect on multiple images, each stage batched
+   * \param images Input images, any size, gray, RGB or RGBA
+   * \return Detections per image
+   */
+  std::vector<std::vector<float>> detect_batch(const std::vector<zz::Image> &images);
+
+  const CascadeConfig &config() const { return config_; }
+
+  /*!
+   * \brief num_frames/num_passed/num_crops Frames seen, frames passing the
+   * gate and crops detected by the second stage so far, whole frames count
+   * as one crop
+   */
+  std::size_t num_frames() const { return num_frames_; }
+  std::size_t num_passed() const { return num_passed_; }
+  std::size_t num_crops() const { return num_crops_; }
+
+ private:
+  bool gate(const std::vector<float> &dets) const;
+  std::vector<zz::Rect> crop_rects(const zz::ImageView<unsigned char> &frame,
+                                   const std::vector<float> &dets) const;
+  std::vector<std::vector<float>> second_stage(
+    const std::vector<zz::ImageView<unsigned char>> &frames,
+    const std::vector<std::vector<float>> &first_dets);
+
+  Detector &first_;
+  Detector &second_;
+  CascadeConfig config_;
+  std::atomic<std::size_t> num_frames_;
+  std::atomic<std::size_t> num_passed_;
+  std::atomic<std::size_t> num_crops_;
+};
+}  // namespace det
+
+#endif  // DET_CASCADE_HPP_
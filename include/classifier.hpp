@@ -0,0 +1,145 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file classifier.hpp
+ * \brief batched crops of detections and their classification
+ */
+
+#ifndef DET_CLASSIFIER_HPP_
+#define DET_CLASSIFIER_HPP_
+
+#include "c_predict_api.h"
+#include "zupply.hpp"
+#include "preprocess.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace det {
+/*!
+ * \brief Resamples detected boxes of a frame straight into one contiguous
+ * input tensor of fixed crop size, ready for a second network. Boxes are
+ * split across a worker pool and each is resized and normalized by one
+ * worker, no per box image is handed out.
+ */
+class CropBatcher {
+ public:
+  /*!
+   * \brief CropBatcher Constructor
+   * \param width Crop width
+   * \param height Crop height
+   * \param num_threads Threads of a pass including the caller, 0 for one per
+   * hardware thread
+   */
+  CropBatcher(int width, int height, unsigned int num_threads = 0);
+
+  /*!
+   * \brief set_input_format Set tensor layout and normalization of crops,
+   * default nchw without mean subtraction
+   */
+  void set_input_format(TensorLayout layout, Normalize norm, const NormParams &params);
+  TensorLayout input_layout() const { return layout_; }
+
+  /*!
+   * \brief set_resize_interp Set interpolation that scales boxes to crop size
+   * \param interp Interpolation, default bilinear
+   */
+  void set_resize_interp(zz::Image::Interp interp) { interp_ = interp; }
+
+  /*!
+   * \brief crop Crop boxes into one tensor in a single parallel pass
+   * \param frame Image detection ran on, gray, RGB or RGBA
+   * \param dets Detections, [id, score, xmin, ymin, xmax, ymax] * N,
+   * coordinates normalized to frame
+   * \param thresh Boxes scoring below are skipped
+   * \param tensor Output, resized to crops * 3 * height * width, reuse it
+   * across calls to keep its allocation
+   * \param context Boxes grow by this fraction of their size on each side
+   * \return Index of the detection of each crop, in tensor order
+   */
+  std::vector<std::size_t> crop(const zz::ImageView<unsigned char> &frame,
+                                const std::vector<float> &dets, float thresh,
+                                std::vector<float> &tensor, float context = 0.f);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+ private:
+  int width_;
+  int height_;
+  TensorLayout layout_;
+  Normalize norm_;
+  NormParams params_;
+  zz::Image::Interp interp_;
+  std::unique_ptr<zz::cds::ThreadPool> pool_;  // null if single threaded
+};
+
+/*!
+ * \brief Second stage classifier of detected boxes, e.g. a finer grained
+ * model, on its own predictors. Crops of a frame run in batched forwards.
+ */
+class Classifier {
+ public:
+  /*!
+   * \brief Classifier Constructor, model is loaded like the detector's
+   * \param model_prefix Model prefix
+   * \param epoch Model epoch
+   * \param width Crop width
+   * \param height Crop height
+   * \param mean_r/mean_g/mean_b Mean pixel values subtracted
+   * \param device_type 1 for cpu, 2 for gpu
+   * \param device_id Device id
+   * \param num_threads Threads cropping one frame, 0 for all cores
+   */
+  Classifier(std::string model_prefix, int epoch, int width, int height,
+             float mean_r, float mean_g, float mean_b,
+             int device_type = 1, int device_id = 0, unsigned int num_threads = 0);
+  ~Classifier();
+
+  /*!
+   * \brief classify Classify detected boxes of a frame
+   * \param frame Image detection ran on
+   * \param dets Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   * \param thresh Boxes scoring below are skipped
+   * \param context Boxes grow by this fraction of their size on each side
+   * \return Output of the classifier per detection, e.g. class
+   * probabilities, empty for skipped ones
+   */
+  std::vector<std::vector<float>> classify(const zz::ImageView<unsigned char> &frame,
+                                           const std::vector<float> &dets,
+                                           float thresh, float context = 0.f);
+
+  /*!
+   * \brief forward Run a batch tensor, e.g. of CropBatcher::crop()
+   * \param tensor Crops * 3 * height * width floats
+   * \param batch Number of crops
+   * \return Output per crop
+   */
+  std::vector<std::vector<float>> forward(const std::vector<float> &tensor,
+                                          unsigned int batch);
+
+  /*!
+   * \brief set_input_format Set tensor layout and normalization the model
+   * expects, predictors are recreated. Not thread safe.
+   */
+  void set_input_format(TensorLayout layout, Normalize norm, const NormParams &params);
+
+  CropBatcher &batcher() { return batcher_; }
+
+ private:
+  PredictorHandle get_predictor(unsigned int batch);
+
+  std::map<unsigned int, PredictorHandle> predictors_;  // keyed by batch size
+  std::vector<char> buffer_;
+  std::string json_;
+  int device_type_;
+  int device_id_;
+  CropBatcher batcher_;
+  std::vector<float> tensor_;  // reused crop batch
+  std::mutex crop_mutex_;
+  std::mutex forward_mutex_;  // predictors are not thread safe
+};
+}  // namespace det
+
+#endif  // DET_CLASSIFIER_HPP_
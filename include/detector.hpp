@@ -4,32 +4,317 @@
  * \brief ssd detection module header
  */
 
+#ifndef DET_DETECTOR_HPP_
+#define DET_DETECTOR_HPP_
+
 #include "c_predict_api.h"
+#include "zupply.hpp"
+#include "box_merge.hpp"
+#include "preprocess.hpp"
+#include "pyramid.hpp"
+#include "result_cache.hpp"
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 namespace det {
+/*!
+ * \brief Completion callback of asynchronous detection, invoked on the worker
+ * thread. On failure detections are empty and error holds the exception.
+ */
+typedef std::function<void(std::vector<float> detections,
+                           std::exception_ptr error)> DetectCallback;
+
+/*!
+ * \brief Test time augmentation. Variants of an image are preprocessed into
+ * the same batch, detected in one forward and merged.
+ */
+struct Augmentation {
+  Augmentation() : flip(false), merge(MergeMode::wbf), iou_thresh(0.55f) {}
+  bool enabled() const { return flip || !scales.empty(); }
+
+  bool flip;  // add a horizontally mirrored copy of every variant
+  std::vector<float> scales;  // extra zooms, above 1 into the center, below 1 shrunk and padded
+  MergeMode merge;
+  float iou_thresh;  // boxes of the same class overlapping more are merged
+};
+
 class Detector {
  public:
   Detector(std::string model_prefix, int epoch, int width, int height,
            float mean_r, float mean_g, float mean_b,
            int device_type=1, int device_id=0);
+  ~Detector();
 
+  /*!
+   * \brief detect Detect objects in image file. Safe to call from multiple
+   * threads, forward passes are serialized.
+   * \param in_img Image file, throws if it can not be read or decoded
+   * \return Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   */
   std::vector<float> detect(std::string in_img);
   std::vector<float> detect(const char *in_img) {
     return detect(std::string(in_img));
   }
 
+  /*!
+   * \brief detect Detect on encoded image file content in memory, result
+   * cache is consulted if enabled
+   * \param data Encoded bytes, e.g. content of a jpeg file
+   * \param len Length of data in bytes
+   * \return Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   */
+  std::vector<float> detect(const unsigned char *data, std::size_t len);
+
+  /*!
+   * \brief detect Detect on already decoded image, gray, RGB or RGBA by its
+   * channels. Channels are converted while preprocessing, no extra pass.
+   * \param image Input image, will be resized to network input size
+   * \return Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   */
+  std::vector<float> detect(zz::Image image);
+
+  /*!
+   * \brief detect Detect on pixels owned elsewhere, e.g. a strided frame
+   * buffer of a capture library. Read in place, not copied.
+   * \param frame Input view, will be resized to network input size
+   * \param order Channel order of frame, e.g. bgr for buffers of OpenCV
+   * \return Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   */
+  std::vector<float> detect(const zz::ImageView<unsigned char> &frame,
+                            PixelOrder order);
+  std::vector<float> detect(const zz::ImageView<unsigned char> &frame);
+
+  /*!
+   * \brief detect_batch Detect on multiple images with batched forward passes
+   * \param images Input images, any size, gray, RGB or RGBA
+   * \return Detections per image
+   */
+  std::vector<std::vector<float>> detect_batch(const std::vector<zz::Image> &images);
+
+  /*!
+   * \brief set_augmentation Enable test time augmentation for detect() and
+   * detect_batch(). Jpegs are decoded large enough for the biggest zoom.
+   * Not thread safe, set before detecting.
+   * \param aug Augmentation, default constructed to disable
+   */
+  void set_augmentation(const Augmentation &aug);
+  const Augmentation &augmentation() const { return aug_; }
+
+  /*!
+   * \brief detect_rois Detect inside fixed zones of a frame with one batched
+   * forward, without augmentation. Zones are resampled in place from the frame, no full copy made.
+   * \param image Input frame
+   * \param rois Zones in pixel coordinates, clipped to the frame
+   * \return Detections per zone, coordinates normalized to the whole frame
+   */
+  std::vector<std::vector<float>> detect_rois(const zz::Image &image,
+                                              const std::vector<zz::Rect> &rois);
+
+  /*!
+   * \brief detect_rois Detect inside zones of several frames, zones of all
+   * frames share batched forwards
+   * \param frames Input frames, gray, RGB or RGBA
+   * \param rois Zones per frame in pixel coordinates, clipped to the frame
+   * \return Detections per frame and zone, normalized to the frame
+   */
+  std::vector<std::vector<std::vector<float>>> detect_rois(
+    const std::vector<zz::ImageView<unsigned char>> &frames,
+    const std::vector<std::vector<zz::Rect>> &rois);
+
+  /*!
+   * \brief detect_pyramid Detect objects of any size on an image pyramid
+   * without augmentation. Levels are cut into tiles of network input size,
+   * tiles of all levels share batched forwards. Boxes cut by an inner tile
+   * border are left to a coarser level, the rest is merged across scales.
+   * Levels smaller than one tile are not built. Concurrent calls share the
+   * pyramid storage and run one at a time.
+   * \param frame Input frame at full resolution, gray, RGB or RGBA
+   * \param config Levels, tiling and merge
+   * \return Detections, [id, score, xmin, ymin, xmax, ymax] * N
+   */
+  std::vector<float> detect_pyramid(const zz::ImageView<unsigned char> &frame,
+                                    const PyramidConfig &config = PyramidConfig());
+
+  /*!
+   * \brief detect_async Queue detection to inference worker threads.
+   * Decode and preprocessing run in parallel on workers, forward passes are
+   * serialized on the shared predictor.
+   * \param in_img Image file
+   * \return Future of detections, errors are rethrown by get()
+   */
+  std::future<std::vector<float>> detect_async(std::string in_img);
+  std::future<std::vector<float>> detect_async(const char *in_img) {
+    return detect_async(std::string(in_img));
+  }
+  std::future<std::vector<float>> detect_async(zz::Image image);
+
+  /*!
+   * \brief detect_async Queue detection, callback runs on the worker thread
+   * \param in_img Image file
+   * \param callback Completion callback
+   */
+  void detect_async(std::string in_img, DetectCallback callback);
+  void detect_async(const char *in_img, DetectCallback callback) {
+    detect_async(std::string(in_img), callback);
+  }
+  void detect_async(zz::Image image, DetectCallback callback);
+
+  /*!
+   * \brief set_async_threads Set number of inference worker threads.
+   * Pending asynchronous requests are finished before workers are replaced.
+   * \param num_threads Number of workers, at least 1
+   */
+  void set_async_threads(unsigned int num_threads);
+
+  /*!
+   * \brief enable_cache Cache results of image files by content hash, so
+   * byte-identical inputs skip decode and forward.
+   * \param max_bytes Memory cap of cache, 0 to disable cache
+   */
+  void enable_cache(std::size_t max_bytes);
+
+  /*!
+   * \brief cache Get result cache, for hit/miss statistics
+   * \return Cache pointer, nullptr if not enabled
+   */
+  const ResultCache *cache() const { return cache_.get(); }
+  ResultCache *cache() { return cache_.get(); }
+
+  /*!
+   * \brief content_key Cache key of encoded image content for this detector
+   * \param data Encoded bytes
+   * \param len Length of data in bytes
+   * \return Key combining content hash and model/input signature
+   */
+  uint64_t content_key(const unsigned char *data, std::size_t len) const;
+
+  /*!
+   * \brief input_width/input_height Network input size
+   */
+  int input_width() const { return static_cast<int>(width_); }
+  int input_height() const { return static_cast<int>(height_); }
+
+  /*!
+   * \brief set_resize_interp Set interpolation that scales inputs to network
+   * size. With area, files are decoded and resampled row by row, see
+   * Image::load_resized. Not thread safe, set before detecting.
+   * \param interp Interpolation, default area
+   */
+  void set_resize_interp(zz::Image::Interp interp);
+  zz::Image::Interp resize_interp() const { return interp_; }
+
+  /*!
+   * \brief set_input_format Set tensor layout and normalization the model
+   * expects, default nchw with the constructor means subtracted. Predictors
+   * are recreated. Not thread safe, set before detecting.
+   * \param layout Input tensor layout
+   * \param norm Normalization
+   * \param params Normalization constants in RGB order
+   */
+  void set_input_format(TensorLayout layout, Normalize norm, const NormParams &params);
+  TensorLayout input_layout() const { return layout_; }
+
+  /*!
+   * \brief load_input Load image file scaled to network input size
+   * \param in_img Image file, throws if it can not be read or decoded
+   * \return Image of input size
+   */
+  zz::Image load_input(const std::string &in_img) const;
+
+  /*!
+   * \brief decode_input Decode encoded image scaled to network input size
+   * \param data Encoded bytes, e.g. content of a jpeg file
+   * \param len Length of data in bytes
+   * \return Image of input size
+   */
+  zz::Image decode_input(const unsigned char *data, std::size_t len) const;
+
+  /*!
+   * \brief fit_input Scale a decoded image to the size load_input() produces,
+   * e.g. before queuing it, so queued frames are small 8 bit images rather
+   * than full frames. Channels are kept.
+   * \param image Decoded image, returned as is if it already has that size
+   * \return Image of input size, larger with zooming augmentation
+   */
+  zz::Image fit_input(zz::Image image) const;
+
+  /*!
+   * \brief decode_size Smallest frame size detect() on decoded pixels needs to
+   * see the detail load_input() would, input size enlarged for zooming
+   * augmentation
+   */
+  void decode_size(int &rows, int &cols) const;
+
  private:
-  PredictorHandle predictor_;
+  std::shared_ptr<zz::cds::ThreadPool> async_pool();
+  PredictorHandle get_predictor(unsigned int batch);
+  void update_signature();
+  void check_input(const zz::ImageView<unsigned char> &image, PixelOrder order) const;
+  void preprocess(const zz::ImageView<unsigned char> &image, PixelOrder order,
+                  float *data_ptr) const;
+  std::vector<std::vector<float>> forward(const std::vector<float> &in_data,
+                                          unsigned int batch, bool exact = false);
+  // writes images [first, first + count) of a batch as float tensor to data
+  typedef std::function<void(unsigned int first, unsigned int count,
+                             float *data)> FillInput;
+  std::vector<std::vector<float>> forward(unsigned int batch, const FillInput &fill,
+                                          bool exact = false);
+  std::vector<std::vector<float>> forward(unsigned int batch, const float *in_data,
+                                          const FillInput *fill, bool exact);
+  // augmented input, frame coordinate = x0 + coordinate in variant * sx
+  struct Variant {
+    bool flip;
+    float x0, y0, sx, sy;
+  };
+  unsigned int num_variants() const;
+  void preprocess_variants(const zz::ImageView<unsigned char> &frame, PixelOrder order,
+                           float *data_ptr, std::vector<Variant> &variants) const;
+  std::vector<std::vector<float>> detect_augmented(
+    const std::vector<zz::ImageView<unsigned char>> &frames,
+    const std::vector<PixelOrder> &orders);
+
+  std::map<unsigned int, PredictorHandle> predictors_;  // keyed by batch size
   std::vector<char> buffer_;
+  std::string json_;
+  int device_type_;
+  int device_id_;
   unsigned int width_;
   unsigned int height_;
-  float mean_r_;
-  float mean_g_;
-  float mean_b_;
+  TensorLayout layout_;
+  Normalize norm_;
+  NormParams norm_params_;
+  zz::Image::Interp interp_;
+  Augmentation aug_;
+  uint64_t model_signature_;  // model and input size
+  uint64_t signature_;  // identifies model and input config in cache keys
+  std::unique_ptr<ResultCache> cache_;
+  std::mutex forward_mutex_;  // predictors are not thread safe
+  std::mutex pool_mutex_;
+  Pyramid pyramid_;  // levels of the last frame, guarded by pyramid_mutex_
+  std::mutex pyramid_mutex_;
+  unsigned int async_threads_;
+  std::shared_ptr<zz::cds::ThreadPool> pool_;
 };  // class Detector
 
+/*!
+ * \brief load_display_image Decode image file for drawing, jpegs are decoded
+ * at the smallest DCT scale that still covers the display size
+ * \param img_path Image file
+ * \param max_disp_size Display size, not positive for full size
+ * \param min_rows/min_cols Size to cover as well, e.g. Detector::decode_size()
+ * when detection runs on the same image
+ * \return Decoded image, at least display size unless the file is smaller
+ */
+zz::Image load_display_image(std::string img_path, int max_disp_size,
+                             int min_rows = 0, int min_cols = 0);
+
 void visualize_detection(std::string img_path,
                std::vector<float> &detections,
                float visu_thresh,
@@ -37,10 +322,35 @@ void visualize_detection(std::string img_path,
                std::vector<std::string> class_names = {},
                std::string out_file = "");
 
+/*!
+ * \brief visualize_detection Draw, save and display on an already decoded
+ * image, e.g. the one detection ran on, so the file is not read again
+ */
+void visualize_detection(zz::Image image,
+               std::vector<float> &detections,
+               float visu_thresh,
+               int max_disp_size,
+               std::vector<std::string> class_names = {},
+               std::string out_file = "");
+
 void save_detection_results(std::string out_file,
                      std::vector<float> &detections,
                      std::vector<std::string> class_names = {},
                      float thresh = 0);
 
 std::vector<std::string> load_class_map(std::string map_file);
+
+/*!
+ * \brief load_model Read symbol and parameters of a model, exits on failure
+ * \param model_prefix Model prefix, files are prefix-symbol.json and
+ * prefix-%04d.params of epoch
+ * \param epoch Model epoch
+ * \param json Symbol json
+ * \param params Parameter file content
+ * \return Parameter file name
+ */
+std::string load_model(const std::string &model_prefix, int epoch,
+                       std::string &json, std::vector<char> &params);
 }  //namespace det
+
+#endif  // DET_DETECTOR_HPP_
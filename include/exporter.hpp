@@ -0,0 +1,83 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file exporter.hpp
+ * \brief parallel export of annotated detection images
+ */
+
+#ifndef DET_EXPORTER_HPP_
+#define DET_EXPORTER_HPP_
+
+#include "renderer.hpp"
+#include "zupply.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace det {
+/*!
+ * \brief Draws detections and writes the annotated images on a worker pool,
+ * so export overlaps with detection on the calling thread. Images are handed
+ * over decoded, workers scale, draw and encode into their own reused buffers.
+ * submit() blocks while twice the workers' count of images is pending, which
+ * keeps memory bounded when detection runs ahead.
+ */
+class AnnotationExporter {
+ public:
+  /*!
+   * \brief AnnotationExporter Constructor, starts the workers
+   * \param class_names Class names for labels
+   * \param thresh Detections below this score are not drawn
+   * \param max_size Images are scaled to fit max_size x max_size, 0 keeps size
+   * \param num_workers Worker threads, 0 for one per hardware thread
+   * \param quality JPEG quality
+   */
+  AnnotationExporter(std::vector<std::string> class_names, float thresh,
+                     int max_size = 0, unsigned int num_workers = 0,
+                     int quality = 100);
+
+  /*!
+   * \brief ~AnnotationExporter Finish pending exports and stop workers
+   */
+  ~AnnotationExporter();
+
+  /*!
+   * \brief submit Queue an image for drawing and saving
+   * \param image Decoded image, e.g. the one detection ran on
+   * \param dets Detections of the image
+   * \param out_file Output file, format by extension
+   */
+  void submit(zz::Image image, std::vector<float> dets, std::string out_file);
+
+  /*!
+   * \brief wait Block until all submitted images are written
+   */
+  void wait();
+
+  /*!
+   * \brief exported/failed Number of images written and failed so far
+   */
+  std::size_t exported() const { return exported_; }
+  std::size_t failed() const { return failed_; }
+
+ private:
+  void export_image(zz::Image &image, const std::vector<float> &dets,
+                    const std::string &out_file);
+
+  Renderer renderer_;
+  float thresh_;
+  int max_size_;
+  int quality_;
+  unsigned int max_pending_;
+  unsigned int pending_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::atomic<std::size_t> exported_;
+  std::atomic<std::size_t> failed_;
+  std::unique_ptr<zz::cds::ThreadPool> pool_;
+};
+}  // namespace det
+
+#endif  // DET_EXPORTER_HPP_
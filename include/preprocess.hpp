@@ -0,0 +1,76 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file preprocess.hpp
+ * \brief conversion of 8 bit images into network input tensors
+ */
+
+#ifndef DET_PREPROCESS_HPP_
+#define DET_PREPROCESS_HPP_
+
+#include "zupply.hpp"
+
+namespace det {
+/*!
+ * \brief Channel order of interleaved source pixels. Alpha is ignored, gray is
+ * replicated to all three channels.
+ */
+enum class PixelOrder { rgb, bgr, rgba, gray };
+
+/*!
+ * \brief Memory layout of the network input tensor
+ */
+enum class TensorLayout { nchw, nhwc };
+
+/*!
+ * \brief Normalization of pixel values,
+ * mean: x - mean, mean_std: (x - mean) / std, scale: x * scale
+ */
+enum class Normalize { mean, mean_std, scale };
+
+/*!
+ * \brief Normalization constants, per channel values in RGB order
+ */
+struct NormParams {
+  NormParams();
+  float mean[3];
+  float std[3];
+  float scale;
+};
+
+/*!
+ * \brief source_channels Number of interleaved channels of a pixel order
+ */
+int source_channels(PixelOrder order);
+
+/*!
+ * \brief pixel_order Order of a decoded image by its channels, gray, rgb or
+ * rgba. Throws ArgException for other channel counts.
+ */
+PixelOrder pixel_order(int channels);
+
+/*!
+ * \brief preprocess Convert an image into a float tensor of three channels in
+ * RGB order. Specialized at compile time on source order, layout,
+ * normalization and mirroring, each combination is a separate kernel
+ * converting four pixels per SSE2 step.
+ * \param image Source pixels, rows may be strided, channels must match Order
+ * \param params Normalization constants
+ * \param out Tensor of one image, 3 * rows * cols floats
+ * \tparam Mirror Flip horizontally while transposing, no extra pass
+ */
+template <PixelOrder Order, TensorLayout Layout, Normalize Norm, bool Mirror = false>
+void preprocess(const zz::ImageView<unsigned char> &image,
+                const NormParams &params, float *out);
+
+typedef void (*PreprocessKernel)(const zz::ImageView<unsigned char> &image,
+                                 const NormParams &params, float *out);
+
+/*!
+ * \brief preprocess_kernel Pick the specialized kernel of a runtime
+ * configuration, once per image rather than per pixel
+ */
+PreprocessKernel preprocess_kernel(PixelOrder order, TensorLayout layout,
+                                   Normalize norm, bool mirror = false);
+}  // namespace det
+
+#endif  // DET_PREPROCESS_HPP_
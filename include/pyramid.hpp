@@ -0,0 +1,71 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file pyramid.hpp
+ * \brief image pyramid of 2x box filtered levels for multi-scale detection
+ */
+
+#ifndef DET_PYRAMID_HPP_
+#define DET_PYRAMID_HPP_
+
+#include "zupply.hpp"
+#include "box_merge.hpp"
+#include <vector>
+
+namespace det {
+/*!
+ * \brief Image pyramid. Level 0 is the input frame itself, each further level
+ * halves the previous one with a 2x2 box filter, so every pixel is read once
+ * per level instead of resampling the full image for each scale. The halved
+ * levels are stacked in one image, a single pooled allocation that is reused
+ * when the pyramid is rebuilt at the same size.
+ */
+class Pyramid {
+ public:
+  /*!
+   * \brief build Build levels of a frame, previous levels are invalidated
+   * \param frame Input, gray, RGB or RGBA, must outlive the use of level 0
+   * \param num_levels Number of levels, at least 1, level k is 1/2^k of frame
+   */
+  void build(const zz::ImageView<unsigned char> &frame, int num_levels);
+
+  int levels() const { return static_cast<int>(levels_.size()); }
+
+  /*!
+   * \brief level View of a level, odd sizes round up so every level covers
+   * the whole frame and normalized coordinates are shared by all levels
+   * \param i Level index, 0 is the frame
+   */
+  const zz::ImageView<unsigned char> &level(int i) const { return levels_[i]; }
+  const std::vector<zz::ImageView<unsigned char>> &level_views() const { return levels_; }
+
+ private:
+  zz::Image storage_;  // levels 1..n stacked vertically
+  std::vector<zz::ImageView<unsigned char>> levels_;
+};
+
+/*!
+ * \brief downsample_half Halve an image with a 2x2 box filter, rounded.
+ * A last odd row or column is averaged with itself.
+ * \param src Source pixels
+ * \param dst Destination of (src.rows() + 1) / 2 rows and (src.cols() + 1) / 2
+ * cols, same channels
+ */
+void downsample_half(const zz::ImageView<unsigned char> &src,
+                     const zz::ImageView<unsigned char> &dst);
+
+/*!
+ * \brief Multi-scale detection on a pyramid. Every level is cut into tiles of
+ * network input size, tiles of all levels run in shared batched forwards and
+ * detections are merged across tiles and scales.
+ */
+struct PyramidConfig {
+  PyramidConfig() : levels(3), overlap(0.25f), merge(MergeMode::nms), iou_thresh(0.5f) {}
+
+  int levels;  // level k is 1/2^k of the frame
+  float overlap;  // fraction of tile size neighboring tiles share
+  MergeMode merge;
+  float iou_thresh;  // boxes of the same class overlapping more are merged
+};
+}  // namespace det
+
+#endif  // DET_PYRAMID_HPP_
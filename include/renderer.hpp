@@ -0,0 +1,110 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file renderer.hpp
+ * \brief headless drawing of detections into images
+ */
+
+#ifndef DET_RENDERER_HPP_
+#define DET_RENDERER_HPP_
+
+#include "zupply.hpp"
+#include <array>
+#include <string>
+#include <vector>
+
+namespace det {
+/*!
+ * \brief Alpha masks of all 256 glyphs of one font height, side by side in a
+ * single buffer. Built once per height from the embedded CImg font.
+ */
+class GlyphAtlas {
+ public:
+  /*!
+   * \brief get Shared atlas of a font height, built on first use. Thread safe.
+   * \param height Font height in pixels
+   */
+  static const GlyphAtlas &get(int height);
+
+  int height() const { return height_; }
+  int stride() const { return stride_; }
+  int width(unsigned char c) const { return width_[c]; }
+
+  /*!
+   * \brief mask First row of a glyph, rows are stride() apart
+   */
+  const unsigned char *mask(unsigned char c) const {
+    return alpha_.data() + offset_[c];
+  }
+
+  /*!
+   * \brief text_width Width in pixels of a single line of text
+   */
+  int text_width(const std::string &text) const;
+
+ private:
+  explicit GlyphAtlas(int height);
+
+  int height_;
+  int stride_;
+  int offset_[256];
+  int width_[256];
+  std::vector<unsigned char> alpha_;
+};
+
+/*!
+ * \brief Draws detection boxes and labels straight into interleaved image
+ * memory, no display or CImg conversion involved. Channels beyond the third
+ * are left untouched. Drawing is clipped to the image.
+ */
+class Renderer {
+ public:
+  /*!
+   * \brief Renderer Constructor, picks a random color per class
+   * \param class_names Class names, labels fall back to ids when empty
+   * \param font_size Label height in pixels
+   * \param thickness Box line width in pixels
+   */
+  explicit Renderer(std::vector<std::string> class_names = {},
+                    int font_size = 20, int thickness = 3);
+
+  /*!
+   * \brief draw Draw boxes and "class: score" labels of detections
+   * \param img Image to draw on
+   * \param dets Detections from Detector, id, score, xmin, ymin, xmax, ymax
+   * normalized to [0, 1]
+   * \param thresh Detections below this score are skipped
+   */
+  void draw(zz::Image &img, const std::vector<float> &dets, float thresh) const;
+
+  /*!
+   * \brief draw_box Draw a rectangle outline, lines are centered on the edges
+   * \param img Image to draw on
+   * \param x0 Left
+   * \param y0 Top
+   * \param x1 Right
+   * \param y1 Bottom
+   * \param color RGB color
+   */
+  void draw_box(zz::Image &img, int x0, int y0, int x1, int y1,
+                const unsigned char *color) const;
+
+  /*!
+   * \brief draw_label Draw white text on a half transparent background
+   * \param img Image to draw on
+   * \param x Left of text
+   * \param y Top of text
+   * \param text Single line of text
+   * \param bg_color RGB background color
+   */
+  void draw_label(zz::Image &img, int x, int y, const std::string &text,
+                  const unsigned char *bg_color) const;
+
+ private:
+  std::vector<std::string> class_names_;
+  std::vector<std::array<unsigned char, 3>> colors_;
+  const GlyphAtlas &atlas_;
+  int thickness_;
+};
+}  // namespace det
+
+#endif  // DET_RENDERER_HPP_
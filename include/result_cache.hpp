@@ -0,0 +1,74 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file result_cache.hpp
+ * \brief content addressed detection result cache
+ */
+
+#ifndef DET_RESULT_CACHE_HPP_
+#define DET_RESULT_CACHE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace det {
+/*!
+ * \brief hash_bytes 64-bit xxHash(XXH64) of a memory buffer
+ * \param data Pointer to buffer
+ * \param len Length in bytes
+ * \param seed Seed, use different seeds to separate key spaces
+ * \return 64-bit hash value
+ */
+uint64_t hash_bytes(const void *data, std::size_t len, uint64_t seed = 0);
+
+/*!
+ * \brief LRU cache of detection results keyed by 64-bit content hash.
+ * Memory usage is capped by max_bytes, least recently used entries are
+ * dropped first. Thread safe.
+ */
+class ResultCache {
+ public:
+  explicit ResultCache(std::size_t max_bytes);
+
+  /*!
+   * \brief get Look up cached result, counts a hit or a miss
+   * \param key Content key
+   * \param result Filled with cached detections if found
+   * \return True if found
+   */
+  bool get(uint64_t key, std::vector<float> &result);
+
+  /*!
+   * \brief put Insert or refresh result, evicting old entries if over budget
+   * \param key Content key
+   * \param result Detections to cache
+   */
+  void put(uint64_t key, const std::vector<float> &result);
+
+  void clear();
+
+  std::size_t hits() const;
+  std::size_t misses() const;
+  std::size_t size() const;
+  std::size_t bytes() const;
+  std::size_t max_bytes() const { return max_bytes_; }
+
+ private:
+  typedef std::pair<uint64_t, std::vector<float>> Entry;
+  static std::size_t entry_bytes(const std::vector<float> &result);
+  void evict();
+
+  std::list<Entry> lru_;  // front is most recently used
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+  std::size_t max_bytes_;
+  std::size_t bytes_;
+  std::size_t hits_;
+  std::size_t misses_;
+  mutable std::mutex mutex_;
+};  // class ResultCache
+}  // namespace det
+
+#endif  // DET_RESULT_CACHE_HPP_
@@ -0,0 +1,78 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file server.hpp
+ * \brief long running detection server over unix domain socket
+ *
+ * Wire protocol, all integers are little endian uint32 unless noted.
+ * A connection may carry any number of request/response pairs.
+ *
+ * Request:  magic "SSDQ" | kind(u8) | reply(u8) | reserved(u16)
+ *           | rows | cols | channels | length | payload[length]
+ *   kind  0: payload is an encoded image file (jpeg, png...)
+ *         1: payload is a raw interleaved 8-bit frame of rows*cols*channels
+ *   reply 0: binary body, float32 [id, score, xmin, ymin, xmax, ymax] * N
+ *         1: json body, {"detections":[{"id":..,"class":..,"score":..,...}]}
+ *
+ * Response: magic "SSDR" | status | length | body[length]
+ *   status 0 ok, 1 bad request, 2 detection failed; on error body is the
+ *   message text (binary) or {"error":"..."} (json).
+ * Coordinates are normalized to [0, 1], only valid detections are returned.
+ */
+
+#ifndef DET_SERVER_HPP_
+#define DET_SERVER_HPP_
+
+#include "detector.hpp"
+#include "batch_queue.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace det {
+class Server {
+ public:
+  /*!
+   * \brief Server Constructor
+   * \param detector Resident detector, also used for result cache lookups
+   * \param queue Batching queue in front of detector
+   * \param class_names Class names for json replies
+   * \param num_workers Max number of connections served concurrently
+   */
+  Server(Detector &detector, BatchQueue &queue,
+         std::vector<std::string> class_names = {}, unsigned int num_workers = 8);
+
+  /*!
+   * \brief serve Bind unix socket and serve until stop() is called.
+   * An existing file at socket path is replaced.
+   * \param socket_path Filesystem path of socket
+   */
+  void serve(std::string socket_path);
+
+  /*!
+   * \brief stop Stop accepting connections, serve() returns after current
+   * connections are closed by clients
+   */
+  void stop();
+
+  /*!
+   * \brief set_max_payload Reject requests with larger payload
+   * \param bytes Limit in bytes
+   */
+  void set_max_payload(std::size_t bytes) { max_payload_ = bytes; }
+
+ private:
+  void handle_connection(int fd);
+  std::vector<float> run(int kind, unsigned int rows, unsigned int cols,
+                         unsigned int channels, std::vector<unsigned char> &payload);
+  std::string format_json(const std::vector<float> &dets) const;
+
+  Detector &detector_;
+  BatchQueue &queue_;
+  std::vector<std::string> class_names_;
+  unsigned int num_workers_;
+  std::size_t max_payload_;
+  std::atomic<int> listen_fd_;
+};  // class Server
+}  // namespace det
+
+#endif  // DET_SERVER_HPP_
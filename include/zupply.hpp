@@ -82,6 +82,9 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
 #include <atomic>
 #include <map>
 #include <unordered_map>
@@ -547,8 +550,160 @@ namespace zz
 	 */
 	typedef Rect2i Rect;
 
+	/*!
+	 * \brief The ImageView class.
+	 * Non-owning view of interleaved pixels with a row stride, e.g. a region of an
+	 * image or a frame buffer owned by another library. Copying and cropping a view
+	 * is O(1), the pixels must outlive the view.
+	 */
+	template<typename _Tp> class ImageView
+	{
+	public:
+		typedef _Tp value_type;
+
+		/*!
+		 * \brief ImageView Default(empty) constructor
+		 */
+		ImageView();
+
+		/*!
+		 * \brief ImageView Constructor wrapping external pixels
+		 * \param data Pointer to first pixel
+		 * \param rows
+		 * \param cols
+		 * \param channels
+		 * \param step Elements between starts of two rows, 0 for cols * channels
+		 */
+		ImageView(_Tp* data, int rows, int cols, int channels, int step = 0);
+
+		/*!
+		 * \brief empty Check empty or not
+		 * \return True if empty
+		 */
+		bool empty() const;
+
+		/*!
+		 * \brief rows Get number of rows(height, y...)
+		 * \return Number of rows(height, y...)
+		 */
+		int rows() const;
+
+		/*!
+		 * \brief cols Get number of columns(width, x...)
+		 * \return Number of columns(width, x...)
+		 */
+		int cols() const;
+
+		/*!
+		 * \brief channels Get number of channels
+		 * \return Number of channels
+		 */
+		int channels() const;
+
+		/*!
+		 * \brief step Get number of elements between starts of two rows
+		 * \return Row stride in elements
+		 */
+		int step() const;
+
+		/*!
+		 * \brief contiguous Check if rows are packed without gaps
+		 * \return True if step equals cols * channels
+		 */
+		bool contiguous() const;
+
+		/*!
+		 * \brief ptr Data pointer given specified position, not range checked.
+		 * \param row
+		 * \param col
+		 * \param channel
+		 * \return Raw pointer to specific data point
+		 */
+		_Tp* ptr(int row = 0, int col = 0, int channel = 0) const;
+
+		/*!
+		 * \brief operator () Access pixel element, not range checked
+		 * \param row
+		 * \param col
+		 * \param channel
+		 * \return
+		 */
+		_Tp& operator() (int row, int col, int channel = 0) const;
+
+		/*!
+		 * \brief crop Sub view of a rectangle area, no pixel is copied.
+		 * Throws ArgException if the area is not inside the view.
+		 * \param rect
+		 * \return View of the area
+		 */
+		ImageView crop(Rect rect) const;
+
+	private:
+		_Tp* data_;
+		int rows_;
+		int cols_;
+		int channels_;
+		int step_;
+	};
+
 	namespace detail
 	{
+		/*!
+		 * \brief pixel_alloc Get a 64 byte aligned block for image storage.
+		 * Blocks come from size-bucketed free lists, so buffers of recurring
+		 * frame sizes are recycled instead of hitting the heap each time.
+		 * \param bytes Block size
+		 * \return Aligned block, throws std::bad_alloc on failure
+		 */
+		void* pixel_alloc(std::size_t bytes);
+
+		/*!
+		 * \brief pixel_free Return a block from pixel_alloc() to the pool.
+		 * \param ptr Block
+		 * \param bytes Size given to pixel_alloc()
+		 */
+		void pixel_free(void* ptr, std::size_t bytes);
+
+		/*!
+		 * \brief pixel_pool_limit Cap bytes kept in the pool free lists.
+		 * \param bytes Maximum cached bytes, 0 to release all and disable caching
+		 */
+		void pixel_pool_limit(std::size_t bytes);
+
+		/*!
+		 * \brief Allocator of image storage, aligned pooled blocks from pixel_alloc()
+		 */
+		template<typename _Tp> class PixelAllocator
+		{
+		public:
+			typedef _Tp value_type;
+
+			PixelAllocator() {}
+			template<typename _Tp2> PixelAllocator(const PixelAllocator<_Tp2>&) {}
+
+			_Tp* allocate(std::size_t n)
+			{
+				return static_cast<_Tp*>(pixel_alloc(n * sizeof(_Tp)));
+			}
+
+			void deallocate(_Tp* ptr, std::size_t n)
+			{
+				pixel_free(ptr, n * sizeof(_Tp));
+			}
+		};
+
+		template<typename _Tp, typename _Tp2> inline
+			bool operator== (const PixelAllocator<_Tp>&, const PixelAllocator<_Tp2>&)
+		{
+				return true;
+			}
+
+		template<typename _Tp, typename _Tp2> inline
+			bool operator!= (const PixelAllocator<_Tp>&, const PixelAllocator<_Tp2>&)
+		{
+				return false;
+			}
+
 		/*!
 		 * \brief Base image storage class
 		 * This defines the storage and pixel-wise access to a image like 3-D matrix
@@ -557,6 +712,7 @@ namespace zz
 		{
 		public:
 			typedef _Tp value_type;
+			typedef std::vector<_Tp, PixelAllocator<_Tp>> storage_type;	//!< 64 byte aligned, pooled
 
 			/*!
 			 * \brief ImageBase Default(empty) constructor
@@ -745,6 +901,28 @@ namespace zz
 			 */
 			void crop(Rect rect);
 
+			/*!
+			 * \brief import Deep copy pixels of a view, e.g. to own an external frame.
+			 * \param view
+			 */
+			void import(const ImageView<_Tp>& view);
+
+			/*!
+			 * \brief view Non-owning view of the whole image.
+			 * Valid while this image keeps its storage. Like ptr(), writing through
+			 * the view does not trigger copy-on-write.
+			 * \return View of the image, empty if the image is empty
+			 */
+			ImageView<_Tp> view() const;
+
+			/*!
+			 * \brief view O(1) crop, view of a rectangle area of the image.
+			 * Throws ArgException if the area is not inside the image.
+			 * \param rect
+			 * \return View of the area
+			 */
+			ImageView<_Tp> view(Rect rect) const;
+
 		protected:
 			void range_check(long long pos) const;
 			void range_check(int row, int col, int channel) const;
@@ -753,7 +931,7 @@ namespace zz
 			int rows_;
 			int cols_;
 			int channels_;
-			std::shared_ptr<std::vector<_Tp>> data_;
+			std::shared_ptr<storage_type> data_;
 
 		};
 	} // namespace zz::detail
@@ -766,6 +944,40 @@ namespace zz
 	class Image : public detail::ImageBase<unsigned char>
 	{
 	public:
+		/*!
+		 * \brief Interpolation used by resize.
+		 * filter is the Mitchell/Catmull-Rom resampler of stb_image_resize. The others
+		 * are fixed point kernels with SSE2/AVX2 vertical passes: nearest, bilinear
+		 * on pixel centers, and area which averages covered pixels (box filter).
+		 */
+		enum class Interp {
+			filter,
+			nearest,
+			bilinear,
+			area
+		};
+
+		/*!
+		 * \brief Channel conversions of convert(), all produce 3 channels.
+		 * rgb2bgr and bgr2rgb are the same swap of first and third channel.
+		 */
+		enum class Convert {
+			gray2rgb,
+			rgba2rgb,
+			bgr2rgb,
+			rgb2bgr
+		};
+
+		/*!
+		 * \brief Size and channels of an encoded image, read from its header.
+		 */
+		struct Info
+		{
+			int rows;
+			int cols;
+			int channels;	//!< channels stored in the file, decoding keeps them
+		};
+
 		/*!
 		 * \brief Image Default(empty) constructor
 		 */
@@ -787,9 +999,94 @@ namespace zz
 
 		/*!
 		 * \brief load Load image from file.
+		 * JPEG images can be decoded at 1/2, 1/4 or 1/8 size directly in DCT domain,
+		 * the smallest of these which is still at least min_rows x min_cols is used.
 		 * \param filename
+		 * \param min_rows Minimum rows wanted, 0 for full size
+		 * \param min_cols Minimum cols wanted, 0 for full size
 		 */
-		void load(const char* filename);
+		void load(const char* filename, int min_rows = 0, int min_cols = 0);
+
+		/*!
+		 * \brief decode Load image from encoded file content in memory.
+		 * \param data Encoded bytes, e.g. content of a jpeg file
+		 * \param len Length of data in bytes
+		 * \param min_rows Minimum rows wanted, 0 for full size, see load()
+		 * \param min_cols Minimum cols wanted, 0 for full size, see load()
+		 */
+		void decode(const unsigned char* data, std::size_t len, int min_rows = 0, int min_cols = 0);
+
+		/*!
+		 * \brief load_resized Load image from file, area resampled to height x width.
+		 * Rows go to the resampler as they are decoded, so baseline JPEGs never keep
+		 * more than a few MCU rows of the source and memory stays close to the output
+		 * size. Other formats are decoded to a full size buffer first.
+		 * \param filename
+		 * \param height New height
+		 * \param width New width
+		 */
+		void load_resized(const char* filename, int height, int width);
+
+		/*!
+		 * \brief decode_resized Decode image from memory, area resampled to height x width.
+		 * See load_resized().
+		 * \param data Encoded bytes, e.g. content of a jpeg file
+		 * \param len Length of data in bytes
+		 * \param height New height
+		 * \param width New width
+		 */
+		void decode_resized(const unsigned char* data, std::size_t len, int height, int width);
+
+		/*!
+		 * \brief probe Read size and channels from the header of an image file, no pixels decoded.
+		 * \param filename
+		 * \return Image info, throws RuntimeException if the header can not be read
+		 */
+		static Info probe(const char* filename);
+
+		/*!
+		 * \brief probe Read size and channels from the header of an encoded image in memory.
+		 * \param data Encoded bytes, e.g. content of a jpeg file
+		 * \param len Length of data in bytes
+		 * \return Image info, throws RuntimeException if the header can not be read
+		 */
+		static Info probe(const unsigned char* data, std::size_t len);
+
+		/*!
+		 * \brief set_max_pixels Reject images larger than this before decoding.
+		 * When set, load(), decode() and their resized versions probe the header
+		 * first and throw ArgException for oversized inputs, so decompression bombs
+		 * cost neither CPU nor memory. Applies to all subsequent calls in the process.
+		 * \param pixels Maximum rows * cols, 0 for no limit
+		 */
+		static void set_max_pixels(std::size_t pixels);
+
+		/*!
+		 * \brief set_decode_threads Set number of threads used to decode one JPEG.
+		 * Only baseline JPEGs with restart markers are split, others decode serially.
+		 * A split decode holds the whole image in component planes, so with more than
+		 * one thread load_resized() of such a JPEG no longer decodes in a few rows.
+		 * Applies to all subsequent load()/decode() calls in the process.
+		 * \param threads Number of threads, 1 to disable
+		 */
+		static void set_decode_threads(int threads);
+
+		/*!
+		 * \brief set_resize_threads Set number of threads used to resize one image.
+		 * Output rows are split into bands, the result is identical to a serial resize.
+		 * Small images are resized on the calling thread. Applies to all subsequent
+		 * Image and ImageHdr resizes in the process.
+		 * \param threads Number of threads, 1 to disable
+		 */
+		static void set_resize_threads(int threads);
+
+		/*!
+		 * \brief set_buffer_pool_limit Cap memory kept for recycling pixel buffers.
+		 * Freed Image and ImageHdr storage goes back to a pool shared by all images,
+		 * 256MB are kept by default.
+		 * \param bytes Maximum cached bytes, 0 to release all and disable recycling
+		 */
+		static void set_buffer_pool_limit(std::size_t bytes);
 
 		/*!
 		 * \brief save Save image to file.
@@ -801,21 +1098,110 @@ namespace zz
 		/*!
 		* \brief resize Resize image given new size
 		* \param sz
+		* \param interp Interpolation
 		*/
-		void resize(Size sz);
+		void resize(Size sz, Interp interp = Interp::filter);
 
 		/*!
 		* \brief resize Resize image given new height and width
 		* \param height
 		* \param width
+		* \param interp Interpolation
 		*/
-		void resize(int height, int width);
+		void resize(int height, int width, Interp interp = Interp::filter);
 
 		/*!
 		* \brief resize Resize image given ratio to the old size
 		* \param ratio
+		* \param interp Interpolation
 		*/
-		void resize(double ratio);
+		void resize(double ratio, Interp interp = Interp::filter);
+
+		/*!
+		* \brief resize_from Resize a region of another image into this image.
+		* The region is read in place from the source, so no cropped copy is made.
+		* \param src Source image
+		* \param roi Region inside source image
+		* \param height New height
+		* \param width New width
+		* \param interp Interpolation
+		*/
+		void resize_from(const Image& src, Rect roi, int height, int width, Interp interp = Interp::filter);
+
+		/*!
+		* \brief resize_from Resize a view, e.g. a crop or an external frame, into this image.
+		* \param src Source view, read in place
+		* \param height New height
+		* \param width New width
+		* \param interp Interpolation
+		*/
+		void resize_from(const ImageView<unsigned char>& src, int height, int width, Interp interp = Interp::filter);
+
+		/*!
+		 * \brief convert Convert channels with SSE2 row kernels. Swaps run in place
+		 * unless the pixels are shared, other conversions write a new buffer.
+		 * \param code Conversion, throws ArgException if channels do not match
+		 * \param background RGB color transparent pixels are composited over for
+		 * rgba2rgb, nullptr drops alpha
+		 */
+		void convert(Convert code, const unsigned char* background = nullptr);
+
+		/*!
+		 * \brief convert_from Convert a view, e.g. an external frame, into this image
+		 * in one pass, see convert().
+		 * \param src Source view, read in place
+		 * \param code Conversion
+		 * \param background RGB color under transparent pixels, nullptr drops alpha
+		 */
+		void convert_from(const ImageView<unsigned char>& src, Convert code, const unsigned char* background = nullptr);
+
+		/*!
+		 * \brief to_rgb Convert gray and RGBA images to RGB, others are unchanged.
+		 * \param background RGB color under transparent pixels, nullptr drops alpha
+		 */
+		void to_rgb(const unsigned char* background = nullptr);
+
+		/*!
+		 * \brief save Save a view to file, see save().
+		 * Strided views are written in place for PNG and packed first for other formats.
+		 * \param filename
+		 * \param src Source view
+		 * \param quality Save quality(0-100), only applied to JPEG image format.
+		 */
+		static void save(const char* filename, const ImageView<unsigned char>& src, int quality = 80);
+
+		/*!
+		 * \brief encode_jpeg Encode image to a JPEG stream in memory.
+		 * \param out Receives the encoded bytes, its capacity is reused
+		 * \param quality Encode quality(0-100)
+		 */
+		void encode_jpeg(std::vector<unsigned char>& out, int quality = 80) const;
+
+		/*!
+		 * \brief encode_png Encode image to a PNG stream in memory.
+		 * \param out Receives the encoded bytes, its capacity is reused
+		 */
+		void encode_png(std::vector<unsigned char>& out) const;
+
+		/*!
+		 * \brief encode_jpeg Encode a view to JPEG in memory, strided rows are read in place.
+		 * \param src Source view
+		 * \param out Receives the encoded bytes
+		 * \param quality Encode quality(0-100)
+		 */
+		static void encode_jpeg(const ImageView<unsigned char>& src, std::vector<unsigned char>& out, int quality = 80);
+
+		/*!
+		 * \brief encode_png Encode a view to PNG in memory, strided rows are read in place.
+		 * \param src Source view
+		 * \param out Receives the encoded bytes
+		 */
+		static void encode_png(const ImageView<unsigned char>& src, std::vector<unsigned char>& out);
+
+	private:
+		// decoder output callback, hands out this image's own storage
+		static unsigned char* decode_storage(void* user, int x, int y, int comp);
+		void decode_finish(unsigned char* buffer, int x, int y, int comp);
 	};
 
 	/*!
@@ -888,7 +1274,7 @@ namespace zz
 		* \param height
 		* \param width
 		*/
-		void resize(int width, int height);
+		void resize(int height, int width);
 
 		/*!
 		* \brief resize Resize image given ratio to the old size
@@ -1376,6 +1762,66 @@ namespace zz
 			};
 		}
 
+		/*!
+		* \class	ThreadPool
+		*
+		* \brief	Fixed size pool of worker threads serving a FIFO task queue.
+		* Pending tasks are finished before the pool is destroyed.
+		*/
+		class ThreadPool : UnMovable
+		{
+		public:
+			/*!
+			 * \brief ThreadPool Constructor
+			 * \param numThreads Number of workers, 0 to use number of hardware threads
+			 */
+			explicit ThreadPool(unsigned numThreads = 0);
+
+			~ThreadPool();
+
+			/*!
+			 * \brief post Queue a task, fire and forget
+			 * \param task
+			 */
+			void post(std::function<void()> task);
+
+			/*!
+			 * \brief enqueue Queue a task and get a future of its result.
+			 * Exceptions thrown by the task are delivered through the future.
+			 * \param f Callable without arguments
+			 * \return Future of result
+			 */
+			template <typename Func> auto enqueue(Func&& f) -> std::future<decltype(f())>
+			{
+				typedef decltype(f()) ResultType;
+				auto task = std::make_shared<std::packaged_task<ResultType()>>(std::forward<Func>(f));
+				std::future<ResultType> ret = task->get_future();
+				post([task]() { (*task)(); });
+				return ret;
+			}
+
+			/*!
+			 * \brief size Number of worker threads
+			 * \return Number of worker threads
+			 */
+			unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+			/*!
+			 * \brief pending Number of tasks waiting in queue
+			 * \return Number of queued tasks
+			 */
+			std::size_t pending();
+
+		private:
+			void worker();
+
+			std::vector<std::thread> workers_;
+			std::deque<std::function<void()>> tasks_;
+			std::mutex mutex_;
+			std::condition_variable cond_;
+			bool stop_;
+		};
+
 		///*!
 		// * \brief AtomicUnorderedMap Template atomic unordered_map<>
 		// * AtomicUnorderedMap is lock-free, however, modification will create copies.
@@ -3069,7 +3515,7 @@ namespace zz
 			/*!
 			 * \brief Set maximum number of argument this option take.
 			 * If maximum number not satisfied, ArgParser will generate an error.
-			 * \param maxCount
+			 * \param maxCount Negative for no limit
 			 * \return Reference to this option
 			 */
 			ArgOption& set_max(int maxCount);
@@ -5071,6 +5517,80 @@ namespace zz
 			return c |= b;
 		}
 
+	////////////////////////////////// ImageView /////////////////////////////////
+	template<typename _Tp> inline
+		ImageView<_Tp>::ImageView()
+		:data_(nullptr), rows_(0), cols_(0), channels_(0), step_(0)
+	{
+		}
+
+	template<typename _Tp> inline
+		ImageView<_Tp>::ImageView(_Tp* data, int rows, int cols, int channels, int step)
+		:data_(data), rows_(rows), cols_(cols), channels_(channels), step_(step > 0 ? step : cols * channels)
+	{
+			assert(rows >= 0 && cols >= 0 && channels >= 0 && step_ >= cols * channels);
+		}
+
+	template<typename _Tp> inline
+		bool ImageView<_Tp>::empty() const
+	{
+			return (rows_ < 1 || cols_ < 1 || channels_ < 1 || (!data_));
+		}
+
+	template<typename _Tp> inline
+		int ImageView<_Tp>::rows() const
+	{
+			return rows_;
+		}
+
+	template<typename _Tp> inline
+		int ImageView<_Tp>::cols() const
+	{
+			return cols_;
+		}
+
+	template<typename _Tp> inline
+		int ImageView<_Tp>::channels() const
+	{
+			return channels_;
+		}
+
+	template<typename _Tp> inline
+		int ImageView<_Tp>::step() const
+	{
+			return step_;
+		}
+
+	template<typename _Tp> inline
+		bool ImageView<_Tp>::contiguous() const
+	{
+			return step_ == cols_ * channels_;
+		}
+
+	template<typename _Tp> inline
+		_Tp* ImageView<_Tp>::ptr(int row, int col, int channel) const
+	{
+			assert(row >= 0 && col >= 0 && channel >= 0 && row <= rows_ && col <= cols_ && channel <= channels_);
+			return data_ + static_cast<std::ptrdiff_t>(row) * step_ + col * channels_ + channel;
+		}
+
+	template<typename _Tp> inline
+		_Tp& ImageView<_Tp>::operator() (int row, int col, int channel) const
+	{
+			return *ptr(row, col, channel);
+		}
+
+	template<typename _Tp> inline
+		ImageView<_Tp> ImageView<_Tp>::crop(Rect rect) const
+	{
+			if (rect.x < 0 || rect.y < 0 || rect.width < 1 || rect.height < 1
+				|| rect.x + rect.width > cols_ || rect.y + rect.height > rows_)
+			{
+				throw ArgException("Crop region out of image!");
+			}
+			return ImageView<_Tp>(ptr(rect.y, rect.x), rect.height, rect.width, channels_, step_);
+		}
+
 	namespace detail
 	{
 		////////////////////////////////// ImageBase /////////////////////////////////
@@ -5133,7 +5653,7 @@ namespace zz
 				rows_ = rows;
 				cols_ = cols;
 				channels_ = channels;
-				data_ = std::make_shared<std::vector<_Tp>>(rows * cols * channels);
+				data_ = std::make_shared<storage_type>(rows * cols * channels);
 			}
 
 		template<typename _Tp> inline
@@ -5178,7 +5698,6 @@ namespace zz
 		template<typename _Tp> inline
 			const _Tp& ImageBase<_Tp>::operator() (int row, int col, int channel) const
 		{
-				detach();
 				long pos = row * cols_ * channels_ + col * channels_ + channel;
 				range_check(row, col, channel);
 				return (*data_)[pos];
@@ -5266,7 +5785,7 @@ namespace zz
 		template<typename _Tp> inline
 			std::vector<_Tp> ImageBase<_Tp>::export_raw() const
 		{
-				return (*data_);
+				return std::vector<_Tp>((*data_).begin(), (*data_).end());
 			}
 
 		template<typename _Tp> template<typename _Tp2> inline
@@ -5291,24 +5810,10 @@ namespace zz
 				int width = std::abs(c0 - c1);
 				int height = std::abs(r0 - r1);
 				int i0 = (std::min)(r0, r1);
-				int i1 = (std::max)(r0, r1);
 				int j0 = (std::min)(c0, c1);
-				int j1 = (std::max)(c0, c1);
-				detach();
-				ImageBase<_Tp> tmp(height, width, channels_);
-
-				// temporary solution, not optimized
-				_Tp* pOld = ptr(i0, j0, 0);
-				_Tp* pNew = tmp.ptr(0);
-				int step = cols_ * channels_;
-				int bulkSize = width * channels_;
-				for (auto r = 0; r < height; ++r)
-				{
-					// copy entire row
-					std::memcpy(pNew, pOld, sizeof(_Tp)* bulkSize);
-					pOld += step;
-					pNew += bulkSize;
-				}
+				// view() for an O(1) crop, this one copies so the old storage can go
+				ImageBase<_Tp> tmp;
+				tmp.import(view(Rect(j0, i0, width, height)));
 				std::swap(*this, tmp);
 			}
 
@@ -5321,7 +5826,34 @@ namespace zz
 		template<typename _Tp> inline
 			void ImageBase<_Tp>::crop(Rect rect)
 		{
-				crop(rect.y, rect.x, rect.y + rect.height, rect.y + rect.width);
+				crop(rect.y, rect.x, rect.y + rect.height, rect.x + rect.width);
+			}
+
+		template<typename _Tp> inline
+			void ImageBase<_Tp>::import(const ImageView<_Tp>& view)
+		{
+				assert(!view.empty() && "import from empty view");
+				ImageBase<_Tp> tmp(view.rows(), view.cols(), view.channels());
+				std::size_t rowSize = static_cast<std::size_t>(view.cols()) * view.channels();
+				for (int r = 0; r < view.rows(); ++r)
+				{
+					std::memcpy((*tmp.data_).data() + r * rowSize, view.ptr(r), sizeof(_Tp)* rowSize);
+				}
+				// view may point into the current storage, replace it only after copying
+				std::swap(*this, tmp);
+			}
+
+		template<typename _Tp> inline
+			ImageView<_Tp> ImageBase<_Tp>::view() const
+		{
+				if (empty()) return ImageView<_Tp>();
+				return ImageView<_Tp>((*data_).data(), rows_, cols_, channels_);
+			}
+
+		template<typename _Tp> inline
+			ImageView<_Tp> ImageBase<_Tp>::view(Rect rect) const
+		{
+				return view().crop(rect);
 			}
 
 		template<typename _Tp> inline
@@ -5329,7 +5861,7 @@ namespace zz
 		{
 				if (data_.use_count() < 2) return;
 				// detach the current resource from shared
-				std::shared_ptr<std::vector<_Tp>> tmp = std::make_shared<std::vector<_Tp>>();
+				std::shared_ptr<storage_type> tmp = std::make_shared<storage_type>();
 				*tmp = *data_; // deep copy
 				data_ = tmp;
 			}
@@ -0,0 +1,141 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file batch_queue.cpp
+ * \brief dynamic batching request queue impl
+ */
+
+#include "batch_queue.hpp"
+#include <algorithm>
+
+namespace det {
+BatchQueue::BatchQueue(Detector &detector, unsigned int max_batch,
+                       unsigned int max_wait_us)
+  : detector_(detector), max_batch_(std::max(max_batch, 1u)),
+  max_wait_(max_wait_us), target_(1), avg_collected_(1.f),
+  num_batches_(0), num_requests_(0), stop_(false) {
+  thread_ = std::thread(&BatchQueue::run, this);
+}
+
+BatchQueue::~BatchQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+std::future<std::vector<float>> BatchQueue::submit(zz::Image image) {
+  Request req;
+  try {
+    // scaled on the submitting thread, the queue holds input sized 8 bit frames
+    req.image = detector_.fit_input(std::move(image));
+  } catch (...) {
+    std::promise<std::vector<float>> failed;
+    failed.set_exception(std::current_exception());
+    return failed.get_future();
+  }
+  req.arrival = std::chrono::steady_clock::now();
+  std::future<std::vector<float>> ret = req.promise.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) throw zz::RuntimeException("Submitting to stopped batch queue!");
+    queue_.push_back(std::move(req));
+  }
+  cond_.notify_one();
+  return ret;
+}
+
+std::future<std::vector<float>> BatchQueue::submit(std::string in_img) {
+  zz::Image image;
+  try {
+    image = detector_.load_input(in_img);
+  } catch (...) {
+    std::promise<std::vector<float>> failed;
+    failed.set_exception(std::current_exception());
+    return failed.get_future();
+  }
+  return submit(std::move(image));
+}
+
+unsigned int BatchQueue::batch_size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return target_;
+}
+
+std::size_t BatchQueue::num_batches() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_batches_;
+}
+
+std::size_t BatchQueue::num_requests() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_requests_;
+}
+
+void BatchQueue::run() {
+  std::vector<Request> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;  // stopped and drained
+
+      // latency window starts at the arrival of the oldest request
+      auto deadline = queue_.front().arrival + max_wait_;
+      bool full = cond_.wait_until(lock, deadline, [this] {
+        return stop_ || queue_.size() >= target_;
+      });
+      full = full && queue_.size() >= target_;
+
+      unsigned int n = static_cast<unsigned int>(
+        std::min<std::size_t>(queue_.size(), max_batch_));
+      for (unsigned int i = 0; i < n; ++i) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+
+      // adapt target: grow while a backlog builds up or more than one
+      // request fills a batch before the deadline, shrink to what actually
+      // arrives when the window expires first. A lone request filling a
+      // target of one is no sign of load.
+      avg_collected_ = 0.7f * avg_collected_ + 0.3f * n;
+      if (!queue_.empty() || (full && n > 1)) {
+        target_ = std::min(target_ * 2, max_batch_);
+      } else {
+        target_ = std::max(1u, std::min(max_batch_,
+          static_cast<unsigned int>(avg_collected_ + 0.5f)));
+      }
+      ++num_batches_;
+      num_requests_ += n;
+    }
+    dispatch(batch);
+    batch.clear();
+  }
+}
+
+void BatchQueue::dispatch(std::vector<Request> &batch) {
+  std::vector<zz::Image> images;
+  images.reserve(batch.size());
+  for (auto &req : batch) images.push_back(req.image);
+  try {
+    std::vector<std::vector<float>> results = detector_.detect_batch(images);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      batch[i].promise.set_value(std::move(results[i]));
+    }
+  } catch (...) {
+    // one bad image fails its batch, retry one by one to isolate it
+    if (batch.size() == 1) {
+      batch[0].promise.set_exception(std::current_exception());
+      return;
+    }
+    for (auto &req : batch) {
+      try {
+        req.promise.set_value(detector_.detect(req.image));
+      } catch (...) {
+        req.promise.set_exception(std::current_exception());
+      }
+    }
+  }
+}
+}  // namespace det
@@ -0,0 +1,106 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file box_merge.cpp
+ * \brief merging of overlapping detections from several passes impl
+ */
+
+#include "box_merge.hpp"
+#include <algorithm>
+
+namespace det {
+namespace {
+struct Box {
+  int id;
+  float score;
+  float coords[4];
+};
+
+struct Cluster {
+  Box fused;
+  float weight;  // sum of member scores
+  float weighted[4];  // sum of member coords times score
+  int count;
+};
+}  // namespace
+
+float box_iou(const float *a, const float *b) {
+  float w = std::min(a[2], b[2]) - std::max(a[0], b[0]);
+  float h = std::min(a[3], b[3]) - std::max(a[1], b[1]);
+  if (w <= 0 || h <= 0) return 0.f;
+  float inter = w * h;
+  float uni = (a[2] - a[0]) * (a[3] - a[1]) + (b[2] - b[0]) * (b[3] - b[1]) - inter;
+  return uni > 0 ? inter / uni : 0.f;
+}
+
+std::vector<float> merge_detections(const std::vector<std::vector<float>> &passes,
+                                    MergeMode mode, float iou_thresh) {
+  std::vector<Box> boxes;
+  for (const std::vector<float> &dets : passes) {
+    for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+      if (dets[i] < 0) continue;  // not an object
+      Box box = {static_cast<int>(dets[i]), dets[i + 1],
+                 {dets[i + 2], dets[i + 3], dets[i + 4], dets[i + 5]}};
+      boxes.push_back(box);
+    }
+  }
+  std::stable_sort(boxes.begin(), boxes.end(), [](const Box &a, const Box &b) {
+    return a.score > b.score;
+  });
+
+  std::vector<Box> merged;
+  if (mode == MergeMode::nms) {
+    // best first, drop boxes overlapping a kept one of the same class
+    for (const Box &box : boxes) {
+      bool suppressed = false;
+      for (const Box &kept : merged) {
+        if (kept.id == box.id && box_iou(kept.coords, box.coords) > iou_thresh) {
+          suppressed = true;
+          break;
+        }
+      }
+      if (!suppressed) merged.push_back(box);
+    }
+  } else {
+    // best first, join the first cluster whose fused box overlaps
+    std::vector<Cluster> clusters;
+    for (const Box &box : boxes) {
+      Cluster *match = nullptr;
+      for (Cluster &c : clusters) {
+        if (c.fused.id == box.id && box_iou(c.fused.coords, box.coords) > iou_thresh) {
+          match = &c;
+          break;
+        }
+      }
+      if (!match) {
+        Cluster c = {box, 0.f, {0.f, 0.f, 0.f, 0.f}, 0};
+        clusters.push_back(c);
+        match = &clusters.back();
+      }
+      match->weight += box.score;
+      ++match->count;
+      for (int k = 0; k < 4; ++k) {
+        match->weighted[k] += box.coords[k] * box.score;
+        match->fused.coords[k] = match->weighted[k] / match->weight;
+      }
+    }
+    // objects found by few passes are scaled down, missing passes count as 0
+    float num_passes = static_cast<float>(std::max<std::size_t>(passes.size(), 1));
+    for (Cluster &c : clusters) {
+      c.fused.score = c.weight / c.count * std::min(static_cast<float>(c.count), num_passes) / num_passes;
+      merged.push_back(c.fused);
+    }
+    std::stable_sort(merged.begin(), merged.end(), [](const Box &a, const Box &b) {
+      return a.score > b.score;
+    });
+  }
+
+  std::vector<float> out;
+  out.reserve(merged.size() * 6);
+  for (const Box &box : merged) {
+    out.push_back(static_cast<float>(box.id));
+    out.push_back(box.score);
+    out.insert(out.end(), box.coords, box.coords + 4);
+  }
+  return out;
+}
+}  // namespace det
@@ -0,0 +1,132 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file cascade.cpp
+ * \brief two stage detection, a cheap model gating an expensive one impl
+ */
+
+#include "cascade.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace det {
+Cascade::Cascade(Detector &first, Detector &second, const CascadeConfig &config)
+  : first_(first), second_(second), config_(config),
+  num_frames_(0), num_passed_(0), num_crops_(0) {
+  if (config_.context < 0) throw zz::ArgException("Cascade context must not be negative");
+}
+
+bool Cascade::gate(const std::vector<float> &dets) const {
+  for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+    if (dets[i] >= 0 && dets[i + 1] >= config_.gate_thresh) return true;
+  }
+  return false;
+}
+
+std::vector<zz::Rect> Cascade::crop_rects(const zz::ImageView<unsigned char> &frame,
+                                          const std::vector<float> &dets) const {
+  zz::Rect whole(0, 0, frame.cols(), frame.rows());
+  std::vector<zz::Rect> rects;
+  if (!config_.crops) return std::vector<zz::Rect>(1, whole);
+
+  float aspect = static_cast<float>(second_.input_width()) / second_.input_height();
+  for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+    if (dets[i] < 0 || dets[i + 1] < config_.gate_thresh) continue;
+    // grow by context, then widen the short side to the second stage's aspect
+    float w = (dets[i + 4] - dets[i + 2]) * frame.cols() * (1 + 2 * config_.context);
+    float h = (dets[i + 5] - dets[i + 3]) * frame.rows() * (1 + 2 * config_.context);
+    if (w < h * aspect) {
+      w = h * aspect;
+    } else {
+      h = w / aspect;
+    }
+    float cx = (dets[i + 2] + dets[i + 4]) * 0.5f * frame.cols();
+    float cy = (dets[i + 3] + dets[i + 5]) * 0.5f * frame.rows();
+    int width = std::max(1, std::min(frame.cols(), static_cast<int>(w + 0.5f)));
+    int height = std::max(1, std::min(frame.rows(), static_cast<int>(h + 0.5f)));
+    // shift inside the frame rather than cut, keeps the context
+    int x = std::min(std::max(0, static_cast<int>(cx - width * 0.5f)), frame.cols() - width);
+    int y = std::min(std::max(0, static_cast<int>(cy - height * 0.5f)), frame.rows() - height);
+    rects.push_back(zz::Rect(x, y, width, height));
+  }
+
+  // join overlapping crops until none overlap
+  bool joined = true;
+  while (joined) {
+    joined = false;
+    for (std::size_t a = 0; a < rects.size() && !joined; ++a) {
+      for (std::size_t b = a + 1; b < rects.size(); ++b) {
+        if ((rects[a] & rects[b]).area() > 0) {
+          rects[a] |= rects[b];
+          rects.erase(rects.begin() + b);
+          joined = true;
+          break;
+        }
+      }
+    }
+  }
+
+  // a few large crops cost more than one pass over the whole frame
+  double area = 0;
+  for (const zz::Rect &r : rects) area += r.area();
+  if (rects.size() > config_.max_crops ||
+      area > config_.max_crop_area * static_cast<double>(whole.area())) {
+    return std::vector<zz::Rect>(1, whole);
+  }
+  return rects;
+}
+
+std::vector<std::vector<float>> Cascade::second_stage(
+  const std::vector<zz::ImageView<unsigned char>> &frames,
+  const std::vector<std::vector<float>> &first_dets) {
+  std::vector<std::vector<float>> results(frames.size());
+  std::vector<zz::ImageView<unsigned char>> passed;
+  std::vector<std::vector<zz::Rect>> rois;
+  std::vector<std::size_t> indices;
+  num_frames_ += frames.size();
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    if (!gate(first_dets[i])) continue;
+    passed.push_back(frames[i]);
+    rois.push_back(crop_rects(frames[i], first_dets[i]));
+    indices.push_back(i);
+    num_crops_ += rois.back().size();
+  }
+  num_passed_ += passed.size();
+  if (passed.empty()) return results;
+
+  // crops of all passed frames in shared batched forwards
+  std::vector<std::vector<std::vector<float>>> outputs = second_.detect_rois(passed, rois);
+  for (std::size_t i = 0; i < passed.size(); ++i) {
+    std::vector<std::vector<float>> &crops = outputs[i];
+    if (crops.size() == 1) {
+      results[indices[i]].swap(crops[0]);
+    } else {
+      results[indices[i]] = merge_detections(crops, MergeMode::nms, config_.iou_thresh);
+    }
+  }
+  return results;
+}
+
+std::vector<float> Cascade::detect(std::string in_img) {
+  std::vector<std::vector<float>> first_dets(1, first_.detect(in_img));
+  if (!gate(first_dets[0])) {
+    ++num_frames_;
+    return std::vector<float>();
+  }
+  zz::Image image(in_img.c_str());
+  std::vector<zz::ImageView<unsigned char>> frames(1, image.view());
+  return std::move(second_stage(frames, first_dets)[0]);
+}
+
+std::vector<float> Cascade::detect(const zz::ImageView<unsigned char> &frame) {
+  std::vector<std::vector<float>> first_dets(1, first_.detect(frame));
+  std::vector<zz::ImageView<unsigned char>> frames(1, frame);
+  return std::move(second_stage(frames, first_dets)[0]);
+}
+
+std::vector<std::vector<float>> Cascade::detect_batch(const std::vector<zz::Image> &images) {
+  std::vector<std::vector<float>> first_dets = first_.detect_batch(images);
+  std::vector<zz::ImageView<unsigned char>> frames;
+  for (const zz::Image &image : images) frames.push_back(image.view());
+  return second_stage(frames, first_dets);
+}
+}  // namespace det
@@ -0,0 +1,187 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file classifier.cpp
+ * \brief batched crops of detections and their classification impl
+ */
+
+#include "classifier.hpp"
+#include "detector.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <thread>
+
+namespace det {
+CropBatcher::CropBatcher(int width, int height, unsigned int num_threads)
+  : width_(width), height_(height), layout_(TensorLayout::nchw),
+  norm_(Normalize::mean), interp_(zz::Image::Interp::bilinear) {
+  if (width < 1 || height < 1) throw zz::ArgException("Invalid crop size");
+  for (int c = 0; c < 3; ++c) params_.mean[c] = 0.f;
+  if (num_threads == 0) num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  // the caller crops a share itself
+  if (num_threads > 1) pool_.reset(new zz::cds::ThreadPool(num_threads - 1));
+}
+
+void CropBatcher::set_input_format(TensorLayout layout, Normalize norm,
+                                   const NormParams &params) {
+  layout_ = layout;
+  norm_ = norm;
+  params_ = params;
+}
+
+std::vector<std::size_t> CropBatcher::crop(const zz::ImageView<unsigned char> &frame,
+                                           const std::vector<float> &dets, float thresh,
+                                           std::vector<float> &tensor, float context) {
+  if (frame.empty()) throw zz::ArgException("Unable to crop from empty image");
+  PreprocessKernel kernel = preprocess_kernel(pixel_order(frame.channels()), layout_, norm_);
+
+  // pixel boxes, grown by context and clipped to the frame
+  std::vector<std::size_t> indices;
+  std::vector<zz::Rect> rects;
+  zz::Rect whole(0, 0, frame.cols(), frame.rows());
+  for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+    if (dets[i] < 0 || dets[i + 1] < thresh) continue;
+    float dx = (dets[i + 4] - dets[i + 2]) * context;
+    float dy = (dets[i + 5] - dets[i + 3]) * context;
+    int x0 = static_cast<int>(std::floor((dets[i + 2] - dx) * frame.cols()));
+    int y0 = static_cast<int>(std::floor((dets[i + 3] - dy) * frame.rows()));
+    int x1 = static_cast<int>(std::ceil((dets[i + 4] + dx) * frame.cols()));
+    int y1 = static_cast<int>(std::ceil((dets[i + 5] + dy) * frame.rows()));
+    zz::Rect rect = zz::Rect(x0, y0, x1 - x0, y1 - y0) & whole;
+    if (rect.area() < 1) continue;
+    indices.push_back(i / 6);
+    rects.push_back(rect);
+  }
+  std::size_t plane = 3 * static_cast<std::size_t>(width_) * height_;
+  tensor.resize(rects.size() * plane);
+  if (rects.empty()) return indices;
+
+  // contiguous ranges of boxes per thread, each with one scratch image
+  auto crop_range = [&](std::size_t first, std::size_t last) {
+    zz::Image scratch;
+    for (std::size_t b = first; b < last; ++b) {
+      scratch.resize_from(frame.crop(rects[b]), height_, width_, interp_);
+      kernel(scratch.view(), params_, tensor.data() + b * plane);
+    }
+  };
+  std::size_t parts = pool_ ? std::min<std::size_t>(rects.size(), pool_->size() + 1) : 1;
+  std::vector<std::future<void>> futures;
+  for (std::size_t p = 1; p < parts; ++p) {
+    std::size_t first = rects.size() * p / parts;
+    std::size_t last = rects.size() * (p + 1) / parts;
+    futures.push_back(pool_->enqueue([&crop_range, first, last]() { crop_range(first, last); }));
+  }
+  crop_range(0, rects.size() / parts);
+  for (auto &f : futures) f.get();  // rethrows failures of workers
+  return indices;
+}
+
+Classifier::Classifier(std::string model_prefix, int epoch, int width, int height,
+                       float mean_r, float mean_g, float mean_b,
+                       int device_type, int device_id, unsigned int num_threads)
+  : device_type_(device_type), device_id_(device_id),
+  batcher_(width, height, num_threads) {
+  load_model(model_prefix, epoch, json_, buffer_);
+  NormParams params;
+  params.mean[0] = mean_r;
+  params.mean[1] = mean_g;
+  params.mean[2] = mean_b;
+  batcher_.set_input_format(TensorLayout::nchw, Normalize::mean, params);
+  get_predictor(1);
+}
+
+Classifier::~Classifier() {
+  for (auto &kv : predictors_) {
+    MXPredFree(kv.second);
+  }
+}
+
+PredictorHandle Classifier::get_predictor(unsigned int batch) {
+  auto it = predictors_.find(batch);
+  if (it != predictors_.end()) return it->second;
+
+  const char *input_keys[1] = {"data"};
+  const mx_uint input_shape_indptr[] = {0, 4};
+  mx_uint input_shape_data[] = {static_cast<mx_uint>(batch), 3,
+    static_cast<mx_uint>(batcher_.height()), static_cast<mx_uint>(batcher_.width())};
+  if (batcher_.input_layout() == TensorLayout::nhwc) {
+    input_shape_data[1] = static_cast<mx_uint>(batcher_.height());
+    input_shape_data[2] = static_cast<mx_uint>(batcher_.width());
+    input_shape_data[3] = 3;
+  }
+  PredictorHandle predictor = NULL;
+  if (MXPredCreate(json_.c_str(), buffer_.data(), static_cast<int>(buffer_.size()),
+      device_type_, device_id_, 1, input_keys, input_shape_indptr,
+      input_shape_data, &predictor) != 0) {
+    std::cerr << "Unable to create predictor: " << MXGetLastError() << std::endl;
+    exit(-1);
+  }
+  predictors_[batch] = predictor;
+  return predictor;
+}
+
+void Classifier::set_input_format(TensorLayout layout, Normalize norm,
+                                  const NormParams &params) {
+  std::lock_guard<std::mutex> lock(forward_mutex_);
+  if (layout != batcher_.input_layout()) {
+    for (auto &kv : predictors_) {
+      MXPredFree(kv.second);
+    }
+    predictors_.clear();
+  }
+  batcher_.set_input_format(layout, norm, params);
+}
+
+std::vector<std::vector<float>> Classifier::forward(const std::vector<float> &tensor,
+                                                    unsigned int batch) {
+  std::lock_guard<std::mutex> lock(forward_mutex_);
+  std::vector<std::vector<float>> results;
+  results.reserve(batch);
+  std::size_t plane = 3 * static_cast<std::size_t>(batcher_.width()) * batcher_.height();
+  assert(tensor.size() == plane * batch);
+
+  // chunks of power of two like the detector, few predictors exist
+  unsigned int done = 0;
+  while (done < batch) {
+    unsigned int chunk = 1;
+    while (chunk * 2 <= batch - done) chunk *= 2;
+    PredictorHandle predictor = get_predictor(chunk);
+    MXPredSetInput(predictor, "data", tensor.data() + done * plane,
+                   static_cast<mx_uint>(chunk * plane));
+    MXPredForward(predictor);
+    mx_uint *shape = NULL;
+    mx_uint shape_len = 0;
+    MXPredGetOutputShape(predictor, 0, &shape, &shape_len);
+    mx_uint tt_size = 1;
+    for (mx_uint i = 0; i < shape_len; ++i) {
+      tt_size *= shape[i];
+    }
+    std::vector<float> outputs(tt_size);
+    MXPredGetOutput(predictor, 0, outputs.data(), tt_size);
+    std::size_t per_crop = tt_size / chunk;
+    for (unsigned int b = 0; b < chunk; ++b) {
+      results.emplace_back(outputs.begin() + b * per_crop,
+                           outputs.begin() + (b + 1) * per_crop);
+    }
+    done += chunk;
+  }
+  return results;
+}
+
+std::vector<std::vector<float>> Classifier::classify(
+  const zz::ImageView<unsigned char> &frame, const std::vector<float> &dets,
+  float thresh, float context) {
+  std::vector<std::vector<float>> results(dets.size() / 6);
+  std::lock_guard<std::mutex> lock(crop_mutex_);
+  std::vector<std::size_t> indices = batcher_.crop(frame, dets, thresh, tensor_, context);
+  if (indices.empty()) return results;
+  std::vector<std::vector<float>> outputs =
+    forward(tensor_, static_cast<unsigned int>(indices.size()));
+  for (std::size_t b = 0; b < indices.size(); ++b) {
+    results[indices[b]].swap(outputs[b]);
+  }
+  return results;
+}
+}  // namespace det
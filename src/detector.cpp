@@ -7,12 +7,17 @@
 #include "zupply.hpp"
 #include "CImg.h"
 #include "detector.hpp"
+#include "renderer.hpp"
+#include "result_cache.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <streambuf>
 #include <cassert>
 #include <cstdlib>
-#include <ctime>
 using namespace cimg_library;
 using namespace zz;
 
@@ -33,43 +38,6 @@ std::vector<std::string> load_class_map(std::string map_file) {
   return classes;
 }
 
-void cimg_draw_box(CImg<unsigned char> &img, int x0, int y0, int x1, int y1,
-                   const unsigned char *color, int thickness = 1) {
-  // wrapper for drawing lines
-  // first check width and height
-  assert (img.spectrum() == 3);
-  int width = img.width();
-  int height = img.height();
-
-  // handle thickness
-  int inside = 0;
-  int outside = 0;
-  if (thickness > 1) {
-    outside = (thickness - 1) / 2;
-    inside = thickness - 1 - outside;
-  }
-
-  for (int i = -outside; i < inside + 1; ++i) {
-    img.draw_line(x0 + i, y0 - outside, x0 + i, y1 + outside, color);  // left
-    img.draw_line(x0 - outside, y0 + i, x1 + outside, y0 + i, color);  // top
-    img.draw_line(x1 + i, y0 - outside, x1 + i, y1 + outside, color);  // right
-    img.draw_line(x0 - outside, y1 + i, x1 + outside, y1 + i, color);  // bot
-  }
-}
-
-void cimg_draw_text(CImg<unsigned char> &img, int x, int y, const char *text,
-                    const unsigned char *bg_color,
-                    const unsigned char *text_color = NULL,
-                    float opacity=0.5, int font_size = 20) {
-  /* wrapper for cimg draw_text */
-  if (!text_color) {
-    const unsigned char white[] = {255, 255, 255};
-    text_color = white;
-  }
-  img.draw_text(x, y, text, text_color, bg_color, opacity, font_size);
-  img.draw_text(x, y, text, text_color, 0, 1, font_size);
-}
-
 void save_detection_results(std::string filename, std::vector<float> &dets,
                             std::vector<std::string> class_names, float thresh) {
   // id, score, xmin, ymin, xmax, ymax
@@ -102,6 +70,7 @@ void save_detection_results(std::string filename, std::vector<float> &dets,
   fe.close();
 }
 
+#if cimg_display
 CImg<unsigned char> zimage_to_cimg(Image &zimg) {
   CImg<unsigned char> cimg(zimg.cols(), zimg.rows(), 1, zimg.channels());
   unsigned char *ptr = zimg.ptr();
@@ -114,64 +83,33 @@ CImg<unsigned char> zimage_to_cimg(Image &zimg) {
   }
   return cimg;
 }
+#endif
 
-Image cimg_to_zimage(CImg<unsigned char> &cimg) {
-  assert (cimg.depth() == 1);  // depth image not supported
-  Image zimg(cimg.height(), cimg.width(), cimg.spectrum());
-  // use high level access, this may impact performance a little bit, but safer
-  for (int r = 0; r < cimg.height(); ++r) {
-    for (int c = 0; c < cimg.width(); ++c) {
-      for (int k = 0; k < cimg.spectrum(); ++k) {
-        zimg(r, c, k) = cimg(c, r, 0, k);
-      }
-    }
-  }
-  return zimg;
+namespace {
+void display_size(int rows, int cols, int max_disp_size, int &disp_rows, int &disp_cols) {
+  float max_size = max_disp_size;
+  float ratio1 = max_size / rows;
+  float ratio2 = max_size / cols;
+  double ratio = ratio1 > ratio2 ? ratio2 : ratio1;
+  disp_rows = static_cast<int>(rows * ratio);
+  disp_cols = static_cast<int>(cols * ratio);
 }
+}  // namespace
 
-void cimg_visualize_detections(CImg<unsigned char> &img, std::vector<float> &dets,
-                               std::vector<std::string> &class_names,
-                               float visu_thresh) {
-  int width = img.width();
-  int height = img.height();
-
-  // generate random colors
-  int num_classes = static_cast<int>(class_names.size());
-  if (num_classes < 1) num_classes = 1;
-  std::vector<std::vector<unsigned char>> colors;
-  std::srand(std::time(0));
-  for (int c = 0; c < num_classes; ++c) {
-    std::vector<unsigned char> color;
-    color.push_back(std::rand() % 255);
-    color.push_back(std::rand() % 255);
-    color.push_back(std::rand() % 255);
-    colors.push_back(color);
-  }
-
-  // id, score, xmin, ymin, xmax, ymax
-  assert (dets.size() % 6 == 0);
-  for (std::size_t i = 0; i < dets.size(); i += 6) {
-    if (dets[i] < 0) continue;  // not an object
-    int id = static_cast<int>(dets[i]);
-    float score = dets[i + 1];
-    if (score < visu_thresh) continue;
-    int xmin = static_cast<int>(dets[i + 2] * width);
-    int ymin = static_cast<int>(dets[i + 3] * height);
-    int xmax = static_cast<int>(dets[i + 4] * width);
-    int ymax = static_cast<int>(dets[i + 5] * height);
-    const unsigned char *color = colors[0].data();
-    std::ostringstream ss;
-    ss.precision(4);
-    ss << score;
-    std::string text = ss.str();
-    if (id < num_classes) {
-      color = colors[id].data();
-      text = class_names[id] + ": " + text;
-    }
-    int font_size = 20;
-    cimg_draw_box(img, xmin, ymin, xmax, ymax, color, 3);
-    cimg_draw_text(img, xmin, ymin - font_size, text.c_str(), color, NULL, 0.5, font_size);
+Image load_display_image(std::string img_path, int max_disp_size,
+                         int min_rows, int min_cols) {
+  Image image;
+  // size comes from the header so jpegs decode at the smallest DCT scale
+  // that still covers the display size and the minimum
+  if (max_disp_size > 0) {
+    Image::Info info = Image::probe(img_path.c_str());
+    int rows, cols;
+    display_size(info.rows, info.cols, max_disp_size, rows, cols);
+    image.load(img_path.c_str(), std::max(rows, min_rows), std::max(cols, min_cols));
+  } else {
+    image.load(img_path.c_str());
   }
+  return image;
 }
 
 void visualize_detection(std::string img_path,
@@ -180,40 +118,53 @@ void visualize_detection(std::string img_path,
                int max_disp_size,
                std::vector<std::string> class_names,
                std::string out_file) {
-  Image image(img_path.c_str());
-  Image bak_img = image;
+  visualize_detection(load_display_image(img_path, max_disp_size), detections,
+                      visu_thresh, max_disp_size, class_names, out_file);
+}
+
+void visualize_detection(Image bak_img,
+               std::vector<float> &detections,
+               float visu_thresh,
+               int max_disp_size,
+               std::vector<std::string> class_names,
+               std::string out_file) {
   // resize for display
   if (max_disp_size > 0) {
-    float max_size = max_disp_size;
-    float ratio1 = max_size / image.rows();
-    float ratio2 = max_size / image.cols();
-    float ratio = ratio1 > ratio2 ? ratio2 : ratio1;
-    bak_img.resize(ratio);
+    int rows, cols;
+    display_size(bak_img.rows(), bak_img.cols(), max_disp_size, rows, cols);
+    if (rows != bak_img.rows() || cols != bak_img.cols()) bak_img.resize(rows, cols);
   }
-  CImg<unsigned char> canvas = zimage_to_cimg(bak_img);
-  cimg_visualize_detections(canvas, detections, class_names, visu_thresh);
+  bak_img.to_rgb();  // colored drawings on gray images too
+  Renderer renderer(class_names);
+  renderer.draw(bak_img, detections, visu_thresh);
 
   // save drawings if required
   if (!out_file.empty()) {
-    Image oimg = cimg_to_zimage(canvas);
     try {
-      oimg.save(out_file.c_str(), 100);
+      bak_img.save(out_file.c_str(), 100);
     } catch (std::exception &e) {
       auto logger = log::get_logger("default");
       logger->error() << e.what();
     }
   }
 
+#if cimg_display
   // display
+  CImg<unsigned char> canvas = zimage_to_cimg(bak_img);
   CImgDisplay main_disp(canvas, "detection");
   while (!main_disp.is_closed()) {
     main_disp.wait();
   }
+#else
+  if (out_file.empty()) {
+    auto logger = log::get_logger("default");
+    logger->warn("Built without display, use -o to save the drawings");
+  }
+#endif
 }
 
-Detector::Detector(std::string model_prefix, int epoch, int width,
-                   int height, float mean_r, float mean_g, float mean_b,
-                   int device_type, int device_id) {
+std::string load_model(const std::string &model_prefix, int epoch,
+                       std::string &json, std::vector<char> &params) {
   auto logger = log::get_logger("default");
   if (epoch < 0 || epoch > 9999) {
     logger->error("Invalid epoch number: ") << epoch;
@@ -229,22 +180,7 @@ Detector::Detector(std::string model_prefix, int epoch, int width,
     std::cerr << "JSON file: " << model_file << " does not exist" << std::endl;
     exit(-1);
   }
-  if (width < 1 || height < 1) {
-    std::cerr << "Invalid width or height: " << width << "," << height << std::endl;
-    exit(-1);
-  }
-  width_ = width;
-  height_ = height;
-  const char *input_name = "data";
-  const char *input_keys[1];
-  input_keys[0] = input_name;
-  const mx_uint input_shape_indptr[] = {0, 4};
-  const mx_uint input_shape_data[] = {1, 3, static_cast<mx_uint>(width_), static_cast<mx_uint>(height_)};
-  mean_r_ = mean_r;
-  mean_g_ = mean_g;
-  mean_b_ = mean_b;
 
-  // load model
   std::ifstream param_file(model_file, std::ios::binary | std::ios::ate);
   if (!param_file.is_open()) {
     std::cerr << "Unable to open model file: " << model_file << std::endl;
@@ -252,77 +188,714 @@ Detector::Detector(std::string model_prefix, int epoch, int width,
   }
   std::streamsize size = param_file.tellg();
   param_file.seekg(0, std::ios::beg);
-  buffer_.resize(size);
+  params.resize(size);
 
   std::ifstream json_handle(json_file, std::ios::ate);
-  std::string json_buffer;
-  json_buffer.reserve(json_handle.tellg());
+  json.reserve(json_handle.tellg());
   json_handle.seekg(0, std::ios::beg);
-  json_buffer.assign((std::istreambuf_iterator<char>(json_handle)), std::istreambuf_iterator<char>());
-  if (json_buffer.size() < 1) {
+  json.assign((std::istreambuf_iterator<char>(json_handle)), std::istreambuf_iterator<char>());
+  if (json.size() < 1) {
     std::cerr << "invalid json file: " << json_file << std::endl;
     exit(-1);
   }
 
-  if (param_file.read(buffer_.data(), size)) {
-    MXPredCreate(json_buffer.c_str(), buffer_.data(), static_cast<int>(size),
-      device_type, device_id, 1, input_keys, input_shape_indptr, input_shape_data,
-      &predictor_);
-  } else {
+  if (!param_file.read(params.data(), size)) {
     std::cerr << "Unable to read model file: " << model_file << std::endl;
     exit(-1);
   }
+  return model_file;
 }
 
-std::vector<float> Detector::detect(std::string in_img) {
-  auto logger = log::get_logger("default");
-  if (!os::is_file(in_img)) {
-    std::cerr << "Image file: " << in_img << " does not exist" << std::endl;
+Detector::Detector(std::string model_prefix, int epoch, int width,
+                   int height, float mean_r, float mean_g, float mean_b,
+                   int device_type, int device_id) {
+  std::string model_file = load_model(model_prefix, epoch, json_, buffer_);
+  if (width < 1 || height < 1) {
+    std::cerr << "Invalid width or height: " << width << "," << height << std::endl;
     exit(-1);
   }
-  Image image(in_img.c_str());
-  if (image.empty()) {
-    std::cerr << "Unable to load image file: " << in_img << std::endl;
-    exit(-1);
+  width_ = width;
+  height_ = height;
+  layout_ = TensorLayout::nchw;
+  norm_ = Normalize::mean;
+  norm_params_.mean[0] = mean_r;
+  norm_params_.mean[1] = mean_g;
+  norm_params_.mean[2] = mean_b;
+  device_type_ = device_type;
+  device_id_ = device_id;
+  async_threads_ = 2;  // one decoding while the other forwards
+
+  // single image predictor is always needed, others are created on demand
+  get_predictor(1);
+
+  std::ostringstream sig;
+  sig << model_file << "|" << width_ << "x" << height_;
+  std::string sig_str = sig.str();
+  model_signature_ = hash_bytes(sig_str.data(), sig_str.size(),
+                                hash_bytes(buffer_.data(), buffer_.size()));
+  set_resize_interp(Image::Interp::area);
+}
+
+void Detector::update_signature() {
+  // everything that changes the output goes into the cache key
+  std::ostringstream sig;
+  sig << static_cast<int>(interp_) << "|" << static_cast<int>(layout_) << "|"
+    << static_cast<int>(norm_) << "|" << norm_params_.scale;
+  for (int c = 0; c < 3; ++c) {
+    sig << "|" << norm_params_.mean[c] << "," << norm_params_.std[c];
+  }
+  if (aug_.enabled()) {
+    sig << "|" << aug_.flip << "," << static_cast<int>(aug_.merge) << "," << aug_.iou_thresh;
+    for (float s : aug_.scales) sig << "," << s;
+  }
+  std::string sig_str = sig.str();
+  signature_ = hash_bytes(sig_str.data(), sig_str.size(), model_signature_);
+}
+
+void Detector::set_resize_interp(Image::Interp interp) {
+  interp_ = interp;
+  update_signature();
+}
+
+void Detector::set_input_format(TensorLayout layout, Normalize norm,
+                                const NormParams &params) {
+  std::lock_guard<std::mutex> lock(forward_mutex_);
+  if (layout != layout_) {
+    // input shape changes, predictors are created again on demand
+    for (auto &kv : predictors_) {
+      MXPredFree(kv.second);
+    }
+    predictors_.clear();
+    layout_ = layout;
+    get_predictor(1);
+  }
+  norm_ = norm;
+  norm_params_ = params;
+  update_signature();
+}
+
+void Detector::set_augmentation(const Augmentation &aug) {
+  for (float s : aug.scales) {
+    if (!(s > 0)) throw ArgException("Augmentation scales must be positive");
+  }
+  aug_ = aug;
+  update_signature();
+}
+
+namespace {
+// input size, enlarged so zooming into the center still has full detail
+void zoomed_input_size(const Augmentation &aug, unsigned int height, unsigned int width,
+                       int &rows, int &cols) {
+  float zoom = 1.f;
+  if (aug.enabled()) {
+    for (float s : aug.scales) zoom = std::max(zoom, s);
+  }
+  rows = static_cast<int>(std::ceil(height * zoom));
+  cols = static_cast<int>(std::ceil(width * zoom));
+}
+}  // namespace
+
+Image Detector::load_input(const std::string &in_img) const {
+  Image image;
+  int rows, cols;
+  zoomed_input_size(aug_, height_, width_, rows, cols);
+  if (interp_ == Image::Interp::area) {
+    image.load_resized(in_img.c_str(), rows, cols);
+  } else {
+    image.load(in_img.c_str(), rows, cols);
+    image.resize(rows, cols, interp_);
+  }
+  return image;
+}
+
+Image Detector::decode_input(const unsigned char *data, std::size_t len) const {
+  Image image;
+  int rows, cols;
+  zoomed_input_size(aug_, height_, width_, rows, cols);
+  if (interp_ == Image::Interp::area) {
+    image.decode_resized(data, len, rows, cols);
+  } else {
+    image.decode(data, len, rows, cols);
+    image.resize(rows, cols, interp_);
+  }
+  return image;
+}
+
+void Detector::decode_size(int &rows, int &cols) const {
+  zoomed_input_size(aug_, height_, width_, rows, cols);
+}
+
+Image Detector::fit_input(Image image) const {
+  int rows, cols;
+  zoomed_input_size(aug_, height_, width_, rows, cols);
+  if (image.empty() || (image.rows() == rows && image.cols() == cols)) return image;
+  Image fitted;
+  fitted.resize_from(image.view(), rows, cols, interp_);
+  return fitted;
+}
+
+Detector::~Detector() {
+  pool_.reset();  // finish pending requests before predictors go away
+  for (auto &kv : predictors_) {
+    MXPredFree(kv.second);
+  }
+}
+
+PredictorHandle Detector::get_predictor(unsigned int batch) {
+  auto it = predictors_.find(batch);
+  if (it != predictors_.end()) return it->second;
+
+  // the c predict api has no reshape, so each batch size owns a predictor
+  const char *input_keys[1] = {"data"};
+  const mx_uint input_shape_indptr[] = {0, 4};
+  mx_uint input_shape_data[] = {static_cast<mx_uint>(batch), 3,
+    static_cast<mx_uint>(height_), static_cast<mx_uint>(width_)};
+  if (layout_ == TensorLayout::nhwc) {
+    input_shape_data[1] = static_cast<mx_uint>(height_);
+    input_shape_data[2] = static_cast<mx_uint>(width_);
+    input_shape_data[3] = 3;
   }
-  if (image.channels() != 3) {
-    std::cerr << "RGB image required" << std::endl;
+  PredictorHandle predictor = NULL;
+  if (MXPredCreate(json_.c_str(), buffer_.data(), static_cast<int>(buffer_.size()),
+      device_type_, device_id_, 1, input_keys, input_shape_indptr,
+      input_shape_data, &predictor) != 0) {
+    std::cerr << "Unable to create predictor: " << MXGetLastError() << std::endl;
     exit(-1);
   }
+  predictors_[batch] = predictor;
+  return predictor;
+}
 
-  // resize image
-  image.resize(height_, width_);
-  int size = image.channels() * image.cols() * image.rows();
-  std::vector<float> in_data(size);
+void Detector::enable_cache(std::size_t max_bytes) {
+  if (max_bytes > 0) {
+    cache_.reset(new ResultCache(max_bytes));
+  } else {
+    cache_.reset();
+  }
+}
 
-  // de-interleave and minus means
-  unsigned char *ptr = image.ptr();
-  float *data_ptr = in_data.data();
-  for (int i = 0; i < size; i +=3) {
-    *(data_ptr++) = static_cast<float>(ptr[i]) - mean_r_;
+uint64_t Detector::content_key(const unsigned char *data, std::size_t len) const {
+  return hash_bytes(data, len, signature_);
+}
+
+std::vector<float> Detector::detect(std::string in_img) {
+  if (!os::is_file(in_img)) {
+    throw ArgException("Image file: " + in_img + " does not exist");
+  }
+  if (!cache_) {
+    return detect(load_input(in_img));
   }
-  for (int i = 1; i < size; i +=3) {
-    *(data_ptr++) = static_cast<float>(ptr[i]) - mean_g_;
+
+  // hash encoded bytes, on hit skip decode, resize and forward entirely
+  std::ifstream fin(in_img, std::ios::binary | std::ios::ate);
+  std::streamoff size = fin ? static_cast<std::streamoff>(fin.tellg()) : -1;
+  if (size < 0) {
+    throw IOException("Unable to read image file: " + in_img);
   }
-  for (int i = 2; i < size; i +=3) {
-    *(data_ptr++) = static_cast<float>(ptr[i]) - mean_b_;
+  std::vector<unsigned char> bytes(static_cast<std::size_t>(size));
+  fin.seekg(0, std::ios::beg);
+  if (!fin.read(reinterpret_cast<char*>(bytes.data()), bytes.size())) {
+    throw IOException("Unable to read image file: " + in_img);
   }
+  return detect(bytes.data(), bytes.size());
+}
 
-  // use model to forward
-  mx_uint *shape = NULL;
-  mx_uint shape_len = 0;
-  MXPredSetInput(predictor_, "data", in_data.data(), static_cast<mx_uint>(size));
-  time::Timer timer;
-  MXPredForward(predictor_);
-  MXPredGetOutputShape(predictor_, 0, &shape, &shape_len);
-  mx_uint tt_size = 1;
-  for (mx_uint i = 0; i < shape_len; ++i) {
-    tt_size *= shape[i];
+std::vector<float> Detector::detect(const unsigned char *data, std::size_t len) {
+  uint64_t key = 0;
+  std::vector<float> outputs;
+  if (cache_) {
+    key = content_key(data, len);
+    if (cache_->get(key, outputs)) return outputs;
   }
-  assert(tt_size % 6 == 0);
-  std::vector<float> outputs(tt_size);
-  MXPredGetOutput(predictor_, 0, outputs.data(), tt_size);
-  logger->info("Forward elapsed time: ") << timer.to_string();
+  outputs = detect(decode_input(data, len));
+  if (cache_) cache_->put(key, outputs);
   return outputs;
 }
+
+void Detector::check_input(const ImageView<unsigned char> &image, PixelOrder order) const {
+  if (image.empty()) {
+    throw ArgException("Unable to detect on empty image");
+  }
+  if (image.channels() != source_channels(order)) {
+    throw ArgException("Image channels do not match pixel order");
+  }
+}
+
+void Detector::preprocess(const ImageView<unsigned char> &image, PixelOrder order,
+                          float *data_ptr) const {
+  // kernel specialized for this order, layout and normalization
+  preprocess_kernel(order, layout_, norm_)(image, norm_params_, data_ptr);
+}
+
+std::vector<std::vector<float>> Detector::forward(const std::vector<float> &in_data,
+                                                  unsigned int batch, bool exact) {
+  assert(in_data.size() == 3 * width_ * height_ * batch);
+  return forward(batch, in_data.data(), nullptr, exact);
+}
+
+std::vector<std::vector<float>> Detector::forward(unsigned int batch, const FillInput &fill,
+                                                  bool exact) {
+  return forward(batch, nullptr, &fill, exact);
+}
+
+std::vector<std::vector<float>> Detector::forward(unsigned int batch, const float *in_data,
+                                                  const FillInput *fill, bool exact) {
+  auto logger = log::get_logger("default");
+  std::vector<std::vector<float>> results;
+  results.reserve(batch);
+  std::size_t plane = 3 * width_ * height_;
+  // chunks are filled outside the lock, so callers normalize while another forwards
+  static thread_local std::vector<float> staging;
+
+  // run in chunks of power of two, so at most log2(batch) predictors exist
+  unsigned int done = 0;
+  while (done < batch) {
+    unsigned int chunk = 1;
+    if (exact) {
+      chunk = batch;  // a fixed size, e.g. augmented variants, gets its own predictor
+    } else {
+      while (chunk * 2 <= batch - done) chunk *= 2;
+    }
+
+    // a filled chunk is still in cache when the predictor copies it
+    const float *chunk_data = in_data ? in_data + done * plane : nullptr;
+    if (fill) {
+      staging.resize(chunk * plane);
+      (*fill)(done, chunk, staging.data());
+      chunk_data = staging.data();
+    }
+    std::lock_guard<std::mutex> lock(forward_mutex_);
+    PredictorHandle predictor = get_predictor(chunk);
+
+    // use model to forward
+    mx_uint *shape = NULL;
+    mx_uint shape_len = 0;
+    MXPredSetInput(predictor, "data", chunk_data, static_cast<mx_uint>(chunk * plane));
+    time::Timer timer;
+    MXPredForward(predictor);
+    MXPredGetOutputShape(predictor, 0, &shape, &shape_len);
+    mx_uint tt_size = 1;
+    for (mx_uint i = 0; i < shape_len; ++i) {
+      tt_size *= shape[i];
+    }
+    assert(tt_size % (6 * chunk) == 0);
+    std::vector<float> outputs(tt_size);
+    MXPredGetOutput(predictor, 0, outputs.data(), tt_size);
+    logger->info("Forward elapsed time: ") << timer.to_string();
+
+    // split batch output, [batch, num_det, 6]
+    std::size_t per_image = tt_size / chunk;
+    for (unsigned int b = 0; b < chunk; ++b) {
+      results.emplace_back(outputs.begin() + b * per_image,
+                           outputs.begin() + (b + 1) * per_image);
+    }
+    done += chunk;
+  }
+  return results;
+}
+
+std::vector<float> Detector::detect(Image image) {
+  return detect(image.view());
+}
+
+std::vector<float> Detector::detect(const ImageView<unsigned char> &frame) {
+  if (frame.empty()) {
+    throw ArgException("Unable to detect on empty image");
+  }
+  return detect(frame, pixel_order(frame.channels()));
+}
+
+std::vector<float> Detector::detect(const ImageView<unsigned char> &frame,
+                                    PixelOrder order) {
+  check_input(frame, order);
+  if (aug_.enabled()) {
+    return detect_augmented({frame}, {order})[0];
+  }
+
+  // resize image, decoded files already come at input size
+  std::vector<float> in_data(3 * width_ * height_);
+  if (frame.rows() != input_height() || frame.cols() != input_width()) {
+    Image resized;
+    resized.resize_from(frame, height_, width_, interp_);
+    preprocess(resized.view(), order, in_data.data());
+  } else {
+    preprocess(frame, order, in_data.data());
+  }
+  return forward(in_data, 1)[0];
+}
+
+std::vector<std::vector<float>> Detector::detect_batch(const std::vector<Image> &images) {
+  if (images.empty()) return std::vector<std::vector<float>>();
+  if (aug_.enabled()) {
+    std::vector<ImageView<unsigned char>> frames;
+    std::vector<PixelOrder> orders;
+    for (const Image &image : images) {
+      frames.push_back(image.view());
+      orders.push_back(pixel_order(image.channels()));
+      check_input(frames.back(), orders.back());
+    }
+    return detect_augmented(frames, orders);
+  }
+  // only resampling happens up front, batches stay 8 bit until the
+  // normalized copy right before each forward
+  std::vector<ImageView<unsigned char>> views;
+  std::vector<PixelOrder> orders;
+  std::vector<Image> resized;
+  for (const Image &image : images) {
+    views.push_back(image.view());
+    orders.push_back(pixel_order(image.channels()));
+    check_input(views.back(), orders.back());
+    if (image.rows() != input_height() || image.cols() != input_width()) {
+      resized.emplace_back();
+      resized.back().resize_from(views.back(), height_, width_, interp_);
+      views.back() = resized.back().view();
+    }
+  }
+  std::size_t plane = 3 * width_ * height_;
+  return forward(static_cast<unsigned int>(images.size()),
+                 [&](unsigned int first, unsigned int count, float *data) {
+    for (unsigned int i = 0; i < count; ++i) {
+      preprocess(views[first + i], orders[first + i], data + i * plane);
+    }
+  });
+}
+
+unsigned int Detector::num_variants() const {
+  unsigned int n = static_cast<unsigned int>(aug_.scales.size()) + 1;
+  return aug_.flip ? 2 * n : n;
+}
+
+namespace {
+// copy a tensor of rows x cols into a larger one at (x, y), rest is padding
+void pad_tensor(const float *src, int rows, int cols, float *dst, int dst_rows,
+                int dst_cols, int x, int y, TensorLayout layout, const float *pad) {
+  std::size_t plane = static_cast<std::size_t>(dst_rows) * dst_cols;
+  if (layout == TensorLayout::nchw) {
+    for (int c = 0; c < 3; ++c) {
+      float *dst_plane = dst + c * plane;
+      std::fill(dst_plane, dst_plane + plane, pad[c]);
+      for (int r = 0; r < rows; ++r) {
+        std::memcpy(dst_plane + (y + r) * dst_cols + x,
+                    src + (c * rows + r) * cols, cols * sizeof(float));
+      }
+    }
+  } else {
+    for (std::size_t i = 0; i < plane; ++i) {
+      for (int c = 0; c < 3; ++c) dst[3 * i + c] = pad[c];
+    }
+    for (int r = 0; r < rows; ++r) {
+      std::memcpy(dst + 3 * ((y + r) * dst_cols + x), src + 3 * r * cols,
+                  3 * cols * sizeof(float));
+    }
+  }
+}
+}  // namespace
+
+void Detector::preprocess_variants(const ImageView<unsigned char> &frame, PixelOrder order,
+                                   float *data_ptr, std::vector<Variant> &variants) const {
+  // every variant is resized once, its mirror is written by the flipping
+  // kernel from the same pixels
+  PreprocessKernel kernel = preprocess_kernel(order, layout_, norm_);
+  PreprocessKernel mirror = preprocess_kernel(order, layout_, norm_, true);
+  std::size_t plane = 3 * width_ * height_;
+  float frame_w = static_cast<float>(frame.cols());
+  float frame_h = static_cast<float>(frame.rows());
+  std::vector<float> scales(1, 1.f);
+  scales.insert(scales.end(), aug_.scales.begin(), aug_.scales.end());
+  Image resized;
+  std::vector<float> shrunk;
+  for (float s : scales) {
+    if (s < 1) {
+      // shrink, the border is the mean pixel after normalization
+      int cols = std::max(1, static_cast<int>(width_ * s + 0.5f));
+      int rows = std::max(1, static_cast<int>(height_ * s + 0.5f));
+      int x = (static_cast<int>(width_) - cols) / 2;
+      int y = (static_cast<int>(height_) - rows) / 2;
+      float pad[3];
+      for (int c = 0; c < 3; ++c) {
+        pad[c] = norm_ == Normalize::scale ? norm_params_.mean[c] * norm_params_.scale : 0.f;
+      }
+      resized.resize_from(frame, rows, cols, interp_);
+      shrunk.resize(3 * rows * cols);
+      Variant variant = {false, -static_cast<float>(x) / cols, -static_cast<float>(y) / rows,
+                         static_cast<float>(width_) / cols, static_cast<float>(height_) / rows};
+      kernel(resized.view(), norm_params_, shrunk.data());
+      pad_tensor(shrunk.data(), rows, cols, data_ptr, height_, width_, x, y, layout_, pad);
+      data_ptr += plane;
+      variants.push_back(variant);
+      if (aug_.flip) {
+        // mirror of the whole canvas, the image sits mirrored too
+        mirror(resized.view(), norm_params_, shrunk.data());
+        pad_tensor(shrunk.data(), rows, cols, data_ptr, height_, width_,
+                   width_ - x - cols, y, layout_, pad);
+        data_ptr += plane;
+        variant.flip = true;
+        variants.push_back(variant);
+      }
+      continue;
+    }
+
+    // zoom into the center, or the whole frame at scale 1
+    int cols = std::max(1, static_cast<int>(frame_w / s + 0.5f));
+    int rows = std::max(1, static_cast<int>(frame_h / s + 0.5f));
+    int x = (frame.cols() - cols) / 2;
+    int y = (frame.rows() - rows) / 2;
+    ImageView<unsigned char> crop(frame.ptr(y, x), rows, cols, frame.channels(), frame.step());
+    ImageView<unsigned char> input = crop;
+    if (rows != input_height() || cols != input_width()) {
+      resized.resize_from(crop, height_, width_, interp_);
+      input = resized.view();
+    }
+    Variant variant = {false, x / frame_w, y / frame_h, cols / frame_w, rows / frame_h};
+    kernel(input, norm_params_, data_ptr);
+    data_ptr += plane;
+    variants.push_back(variant);
+    if (aug_.flip) {
+      mirror(input, norm_params_, data_ptr);
+      data_ptr += plane;
+      variant.flip = true;
+      variants.push_back(variant);
+    }
+  }
+}
+
+std::vector<std::vector<float>> Detector::detect_augmented(
+    const std::vector<ImageView<unsigned char>> &frames,
+    const std::vector<PixelOrder> &orders) {
+  unsigned int per_image = num_variants();
+  unsigned int batch = static_cast<unsigned int>(frames.size()) * per_image;
+  std::size_t plane = 3 * width_ * height_;
+  std::vector<float> in_data(batch * plane);
+  std::vector<Variant> variants;
+  variants.reserve(batch);
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    preprocess_variants(frames[i], orders[i], in_data.data() + i * per_image * plane, variants);
+  }
+  // one image always has the same number of variants, worth an exact predictor
+  std::vector<std::vector<float>> outputs = forward(in_data, batch, frames.size() == 1);
+
+  // back to frame coordinates, boxes only in the padding vanish
+  for (unsigned int b = 0; b < batch; ++b) {
+    const Variant &v = variants[b];
+    std::vector<float> &dets = outputs[b];
+    for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+      if (dets[i] < 0) continue;
+      float xmin = v.flip ? 1.f - dets[i + 4] : dets[i + 2];
+      float xmax = v.flip ? 1.f - dets[i + 2] : dets[i + 4];
+      dets[i + 2] = std::min(std::max(v.x0 + xmin * v.sx, 0.f), 1.f);
+      dets[i + 3] = std::min(std::max(v.y0 + dets[i + 3] * v.sy, 0.f), 1.f);
+      dets[i + 4] = std::min(std::max(v.x0 + xmax * v.sx, 0.f), 1.f);
+      dets[i + 5] = std::min(std::max(v.y0 + dets[i + 5] * v.sy, 0.f), 1.f);
+      if (dets[i + 4] <= dets[i + 2] || dets[i + 5] <= dets[i + 3]) dets[i] = -1;
+    }
+  }
+
+  std::vector<std::vector<float>> results(frames.size());
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    std::vector<std::vector<float>> passes(outputs.begin() + i * per_image,
+                                           outputs.begin() + (i + 1) * per_image);
+    results[i] = merge_detections(passes, aug_.merge, aug_.iou_thresh);
+  }
+  return results;
+}
+
+std::shared_ptr<cds::ThreadPool> Detector::async_pool() {
+  // a copy, so a concurrent set_async_threads() can not free it under the caller
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  if (!pool_) pool_ = std::make_shared<cds::ThreadPool>(async_threads_);
+  return pool_;
+}
+
+void Detector::set_async_threads(unsigned int num_threads) {
+  std::shared_ptr<cds::ThreadPool> old;
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    async_threads_ = num_threads > 0 ? num_threads : 1;
+    old.swap(pool_);
+  }
+  // joins old workers after draining their queue, unless a caller still
+  // enqueues into it, then the last holder does
+  old.reset();
+}
+
+std::future<std::vector<float>> Detector::detect_async(std::string in_img) {
+  return async_pool()->enqueue([this, in_img]() { return detect(in_img); });
+}
+
+std::future<std::vector<float>> Detector::detect_async(Image image) {
+  return async_pool()->enqueue([this, image]() { return detect(image); });
+}
+
+namespace {
+void run_callback(const DetectCallback &callback,
+                  std::function<std::vector<float>()> job) {
+  std::vector<float> dets;
+  std::exception_ptr error;
+  try {
+    dets = job();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  try {
+    callback(std::move(dets), error);
+  } catch (...) {
+    // never let user code unwind a worker thread
+    log::get_logger("default")->error("Exception escaped detect callback");
+  }
+}
+}  // namespace
+
+void Detector::detect_async(std::string in_img, DetectCallback callback) {
+  async_pool()->post([this, in_img, callback]() {
+    run_callback(callback, [this, &in_img]() { return detect(in_img); });
+  });
+}
+
+void Detector::detect_async(Image image, DetectCallback callback) {
+  async_pool()->post([this, image, callback]() {
+    run_callback(callback, [this, &image]() { return detect(image); });
+  });
+}
+
+namespace {
+// offsets of tiles covering length, neighbors share at least overlap
+std::vector<int> tile_offsets(int length, int tile, int overlap) {
+  if (length <= tile) return std::vector<int>(1, 0);
+  int stride = std::max(1, tile - overlap);
+  int n = (length - tile + stride - 1) / stride + 1;
+  std::vector<int> offsets;
+  for (int i = 0; i < n; ++i) {
+    offsets.push_back(static_cast<int>(static_cast<long long>(length - tile) * i / (n - 1)));
+  }
+  return offsets;
+}
+}  // namespace
+
+std::vector<float> Detector::detect_pyramid(const ImageView<unsigned char> &frame,
+                                            const PyramidConfig &config) {
+  if (frame.empty()) {
+    throw ArgException("Unable to detect on empty image");
+  }
+  if (config.overlap < 0 || config.overlap >= 1) {
+    throw ArgException("Tile overlap must be in [0, 1)");
+  }
+  // no level below the first one fitting a single tile
+  int num_levels = 1;
+  int rows = frame.rows();
+  int cols = frame.cols();
+  while (num_levels < config.levels &&
+         (rows > static_cast<int>(height_) || cols > static_cast<int>(width_))) {
+    rows = (rows + 1) / 2;
+    cols = (cols + 1) / 2;
+    ++num_levels;
+  }
+  // level storage is reused across frames of the same size
+  std::lock_guard<std::mutex> lock(pyramid_mutex_);
+  pyramid_.build(frame, num_levels);
+
+  std::vector<std::vector<Rect>> tiles(num_levels);
+  for (int l = 0; l < num_levels; ++l) {
+    const ImageView<unsigned char> &level = pyramid_.level(l);
+    int tile_w = std::min(static_cast<int>(width_), level.cols());
+    int tile_h = std::min(static_cast<int>(height_), level.rows());
+    for (int y : tile_offsets(level.rows(), tile_h, static_cast<int>(tile_h * config.overlap))) {
+      for (int x : tile_offsets(level.cols(), tile_w, static_cast<int>(tile_w * config.overlap))) {
+        tiles[l].push_back(Rect(x, y, tile_w, tile_h));
+      }
+    }
+  }
+  std::vector<std::vector<std::vector<float>>> outputs =
+    detect_rois(pyramid_.level_views(), tiles);
+
+  // one pass, scores of objects missing on some levels are not lowered
+  std::vector<std::vector<float>> passes(1);
+  std::vector<float> &all = passes[0];
+  for (int l = 0; l < num_levels; ++l) {
+    const ImageView<unsigned char> &level = pyramid_.level(l);
+    bool coarsest = l + 1 == num_levels;
+    for (std::size_t t = 0; t < tiles[l].size(); ++t) {
+      const Rect &tile = tiles[l][t];
+      const std::vector<float> &dets = outputs[l][t];
+      for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+        if (dets[i] < 0) continue;
+        if (!coarsest) {
+          // cut by an inner border, a coarser level sees the whole object
+          float x0 = dets[i + 2] * level.cols() - tile.x;
+          float y0 = dets[i + 3] * level.rows() - tile.y;
+          float x1 = dets[i + 4] * level.cols() - tile.x;
+          float y1 = dets[i + 5] * level.rows() - tile.y;
+          if ((tile.x > 0 && x0 < 1) || (tile.y > 0 && y0 < 1) ||
+              (tile.x + tile.width < level.cols() && x1 > tile.width - 1) ||
+              (tile.y + tile.height < level.rows() && y1 > tile.height - 1)) {
+            continue;
+          }
+        }
+        all.insert(all.end(), dets.begin() + i, dets.begin() + i + 6);
+      }
+    }
+  }
+  return merge_detections(passes, config.merge, config.iou_thresh);
+}
+
+std::vector<std::vector<float>> Detector::detect_rois(const Image &image,
+                                                      const std::vector<Rect> &rois) {
+  std::vector<ImageView<unsigned char>> frames(1, image.view());
+  std::vector<std::vector<Rect>> frame_rois(1, rois);
+  return std::move(detect_rois(frames, frame_rois)[0]);
+}
+
+std::vector<std::vector<std::vector<float>>> Detector::detect_rois(
+  const std::vector<ImageView<unsigned char>> &frames,
+  const std::vector<std::vector<Rect>> &rois) {
+  if (frames.size() != rois.size()) {
+    throw ArgException("Need zones for each frame");
+  }
+  std::vector<PixelOrder> orders;
+  std::vector<std::vector<std::vector<float>>> results(frames.size());
+  // flattened zones of all frames
+  std::vector<Rect> valid_rois;
+  std::vector<std::pair<std::size_t, std::size_t>> indices;
+  for (std::size_t f = 0; f < frames.size(); ++f) {
+    orders.push_back(pixel_order(frames[f].channels()));
+    check_input(frames[f], orders.back());
+    results[f].resize(rois[f].size());
+    Rect frame(0, 0, frames[f].cols(), frames[f].rows());
+    for (std::size_t i = 0; i < rois[f].size(); ++i) {
+      Rect roi = rois[f][i] & frame;
+      if (roi.area() < 1) continue;  // outside of image, no detections
+      valid_rois.push_back(roi);
+      indices.push_back(std::make_pair(f, i));
+    }
+  }
+  if (valid_rois.empty()) return results;
+
+  // resample each zone straight from its frame into one batched tensor
+  unsigned int batch = static_cast<unsigned int>(valid_rois.size());
+  std::size_t plane = 3 * width_ * height_;
+  std::vector<float> in_data(batch * plane);
+  Image crop;
+  for (unsigned int b = 0; b < batch; ++b) {
+    crop.resize_from(frames[indices[b].first].crop(valid_rois[b]), height_, width_, interp_);
+    preprocess(crop.view(), orders[indices[b].first], in_data.data() + b * plane);
+  }
+  std::vector<std::vector<float>> outputs = forward(in_data, batch);
+
+  // map normalized roi coordinates back to normalized frame coordinates
+  for (unsigned int b = 0; b < batch; ++b) {
+    const Rect &roi = valid_rois[b];
+    const ImageView<unsigned char> &frame = frames[indices[b].first];
+    float frame_w = static_cast<float>(frame.cols());
+    float frame_h = static_cast<float>(frame.rows());
+    std::vector<float> &dets = outputs[b];
+    for (std::size_t i = 0; i < dets.size(); i += 6) {
+      if (dets[i] < 0) continue;
+      dets[i + 2] = (roi.x + dets[i + 2] * roi.width) / frame_w;
+      dets[i + 3] = (roi.y + dets[i + 3] * roi.height) / frame_h;
+      dets[i + 4] = (roi.x + dets[i + 4] * roi.width) / frame_w;
+      dets[i + 5] = (roi.y + dets[i + 5] * roi.height) / frame_h;
+    }
+    results[indices[b].first][indices[b].second].swap(dets);
+  }
+  return results;
+}
 }  // namespace det
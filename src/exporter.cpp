@@ -0,0 +1,95 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file exporter.cpp
+ * \brief parallel export of annotated detection images impl
+ */
+
+#include "exporter.hpp"
+#include <fstream>
+
+namespace det {
+namespace {
+struct ExportJob {
+  zz::Image image;
+  std::vector<float> dets;
+  std::string out_file;
+};
+}  // namespace
+
+AnnotationExporter::AnnotationExporter(std::vector<std::string> class_names,
+                                       float thresh, int max_size,
+                                       unsigned int num_workers, int quality)
+  : renderer_(class_names), thresh_(thresh), max_size_(max_size),
+  quality_(quality), pending_(0), exported_(0), failed_(0),
+  pool_(new zz::cds::ThreadPool(num_workers)) {
+  max_pending_ = 2 * pool_->size();
+}
+
+AnnotationExporter::~AnnotationExporter() {
+  pool_.reset();  // drains queued exports
+}
+
+void AnnotationExporter::submit(zz::Image image, std::vector<float> dets,
+                                std::string out_file) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return pending_ < max_pending_; });
+    ++pending_;
+  }
+  // shared, so the pixels have a single owner when drawn in place
+  auto job = std::make_shared<ExportJob>();
+  job->image = std::move(image);
+  job->dets = std::move(dets);
+  job->out_file = std::move(out_file);
+  pool_->post([this, job]() {
+    try {
+      export_image(job->image, job->dets, job->out_file);
+      ++exported_;
+    } catch (std::exception &e) {
+      ++failed_;
+      zz::log::get_logger("default")->error("Export failed: ") << job->out_file
+        << ", " << e.what();
+    }
+    job->image = zz::Image();  // pixels back to the pool before waking submit
+    std::lock_guard<std::mutex> lock(mutex_);
+    --pending_;
+    cond_.notify_all();
+  });
+}
+
+void AnnotationExporter::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+void AnnotationExporter::export_image(zz::Image &image, const std::vector<float> &dets,
+                                      const std::string &out_file) {
+  if (max_size_ > 0) {
+    float ratio1 = static_cast<float>(max_size_) / image.rows();
+    float ratio2 = static_cast<float>(max_size_) / image.cols();
+    double ratio = ratio1 > ratio2 ? ratio2 : ratio1;
+    int rows = static_cast<int>(image.rows() * ratio);
+    int cols = static_cast<int>(image.cols() * ratio);
+    if (rows != image.rows() || cols != image.cols()) image.resize(rows, cols);
+  }
+  image.to_rgb();  // colored drawings on gray images too
+  renderer_.draw(image, dets, thresh_);
+
+  // encoded bytes go to a per worker buffer, reused across images
+  static thread_local std::vector<unsigned char> buffer;
+  std::string ext = zz::fmt::to_lower_ascii(zz::os::path_split_extension(out_file));
+  if (ext == "jpg" || ext == "jpeg") {
+    image.encode_jpeg(buffer, quality_);
+  } else if (ext == "png") {
+    image.encode_png(buffer);
+  } else {
+    image.save(out_file.c_str(), quality_);
+    return;
+  }
+  std::fstream fout;
+  zz::os::fstream_open(fout, out_file, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!fout.write(reinterpret_cast<const char*>(buffer.data()), buffer.size())) {
+    throw zz::IOException("Unable to write file: " + out_file);
+  }
+}
+}  // namespace det
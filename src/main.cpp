@@ -6,7 +6,13 @@
 
 #include "zupply.hpp"
 #include "detector.hpp"
+#include "batch_queue.hpp"
+#include "cascade.hpp"
+#include "exporter.hpp"
+#include "server.hpp"
 #include <iostream>
+#include <map>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -21,11 +27,35 @@ int main(int argc, char **argv) {
   float mean_r;
   float mean_g;
   float mean_b;
+  std::vector<float> stds;
+  float scale;
   float visu_thresh;
   int gpu_id;
   int max_disp_size;
   std::string result_file;
   std::string class_map_file;
+  std::string serve_socket;
+  int cache_size;
+  int max_batch;
+  int batch_wait;
+  int decode_threads;
+  int resize_threads;
+  int max_pixels;
+  int export_threads;
+  std::string resize_mode;
+  std::string layout;
+  bool tta_flip;
+  std::vector<float> tta_scales;
+  std::string tta_merge;
+  float tta_iou;
+  std::string gate_model;
+  int gate_epoch;
+  int gate_width;
+  int gate_height;
+  float gate_thresh;
+  bool gate_whole;
+  int pyramid_levels;
+  float tile_overlap;
   std::vector<std::string> class_names = {
      "aeroplane", "bicycle", "bird", "boat",
      "bottle", "bus", "car", "cat", "chair",
@@ -37,21 +67,45 @@ int main(int argc, char **argv) {
   zz::cfg::ArgParser parser;
   parser.add_opt_help('h', "help");
   parser.add_opt_version('v', "version", "0.1");
-  parser.add_opt_value('o', "out", out_name, std::string(), "output detection result to image", "FILE");
+  parser.add_opt_value('o', "out", out_name, std::string(), "output detection result to image, directory with multiple inputs", "FILE");
   parser.add_opt_value('m', "model", model_prefix, std::string(default_model), "load model prefix", "FILE");
   parser.add_opt_value('e', "epoch", epoch, 1, "load model epoch", "INT");
   parser.add_opt_value(-1, "class-map", class_map_file, std::string(), "load classes from text file", "FILE");
   parser.add_opt_value(-1, "width", width, 300, "resize width", "INT");
   parser.add_opt_value(-1, "height", height, 300, "resize height", "INT");
+  parser.add_opt_value(-1, "resize", resize_mode, std::string("area"), "resize mode: area, bilinear, nearest, filter", "MODE");
   parser.add_opt_value('r', "red", mean_r, 123.f, "red mean pixel value", "FLOAT");
   parser.add_opt_value('g', "green", mean_g, 117.f, "green mean pixel value", "FLOAT");
   parser.add_opt_value('b', "blue", mean_b, 104.f, "blue mean pixel value", "FLOAT");
+  parser.add_opt_value(-1, "std", stds, std::vector<float>(), "divide by red, green and blue std after mean subtraction", "FLOAT", 3, 3);
+  parser.add_opt_value(-1, "scale", scale, 0.f, "multiply pixel values by scale instead of mean subtraction", "FLOAT");
+  parser.add_opt_value(-1, "layout", layout, std::string("nchw"), "input tensor layout: nchw, nhwc", "MODE");
+  parser.add_opt_flag(-1, "tta-flip", "test time augmentation, add mirrored images to the batch", &tta_flip);
+  parser.add_opt_value(-1, "tta-scales", tta_scales, std::vector<float>(), "test time augmentation, add zoomed images to the batch, e.g. 1.5 0.75", "FLOAT", 1, -1);
+  parser.add_opt_value(-1, "tta-merge", tta_merge, std::string("wbf"), "merge augmented detections: wbf, nms", "MODE");
+  parser.add_opt_value(-1, "tta-iou", tta_iou, 0.55f, "overlap of augmented detections to merge", "FLOAT");
+  parser.add_opt_value(-1, "gate-model", gate_model, std::string(), "cheap model prefix, -m model runs only where it finds candidates", "FILE");
+  parser.add_opt_value(-1, "gate-epoch", gate_epoch, 1, "load gate model epoch", "INT");
+  parser.add_opt_value(-1, "gate-width", gate_width, 0, "gate model resize width, 0 for --width", "INT");
+  parser.add_opt_value(-1, "gate-height", gate_height, 0, "gate model resize height, 0 for --height", "INT");
+  parser.add_opt_value(-1, "gate-thresh", gate_thresh, 0.3f, "gate model score of a candidate", "FLOAT");
+  parser.add_opt_flag(-1, "gate-whole", "run -m model on whole images with candidates, not on crops around them", &gate_whole);
+  parser.add_opt_value(-1, "pyramid", pyramid_levels, 0, "detect on tiles of an image pyramid of this many levels, 0 to disable", "INT");
+  parser.add_opt_value(-1, "tile-overlap", tile_overlap, 0.25f, "fraction of tile size neighboring pyramid tiles share", "FLOAT");
   parser.add_opt_value('t', "thresh", visu_thresh, 0.5f, "visualize threshold", "FLOAT");
   parser.add_opt_value(-1, "gpu", gpu_id, -1, "gpu id to detect with, default use cpu", "INT");
   parser.add_opt_value(-1, "disp-size", max_disp_size, 640, "display size, -1 to disable display", "INT");
-  parser.add_opt_value(-1, "save-result", result_file, std::string(), "save result in text file", "FILE");
+  parser.add_opt_value(-1, "save-result", result_file, std::string(), "save result in text file, directory with multiple inputs", "FILE");
+  parser.add_opt_value(-1, "serve", serve_socket, std::string(), "keep model loaded and serve on unix socket", "FILE");
+  parser.add_opt_value(-1, "cache-size", cache_size, 0, "result cache size in MB for server, 0 to disable", "INT");
+  parser.add_opt_value(-1, "max-batch", max_batch, 8, "max batch size for server", "INT");
+  parser.add_opt_value(-1, "batch-wait", batch_wait, 5000, "max wait in us to fill a batch for server", "INT");
+  parser.add_opt_value(-1, "decode-threads", decode_threads, 1, "threads to decode one jpeg with restart markers, it is then held in memory at full size", "INT");
+  parser.add_opt_value(-1, "resize-threads", resize_threads, 1, "threads to resize one large image in row bands", "INT");
+  parser.add_opt_value(-1, "max-pixels", max_pixels, 0, "reject images with more pixels before decoding, 0 for no limit", "INT");
+  parser.add_opt_value(-1, "export-threads", export_threads, 0, "threads to draw and save -o images of multiple inputs, 0 for all cores", "INT");
   zz::cfg::ArgOption& input = parser.add_opt(-1, "").set_type("FILE")
-    .set_help("input image").set_min(1).set_max(1).require();
+    .set_help("input images").set_min(1).set_max(-1);
 
   parser.parse(argc, argv);
   // check errors
@@ -60,6 +114,50 @@ int main(int argc, char **argv) {
     std::cout << parser.get_help() << std::endl;
     exit(-1);
   }
+  if (serve_socket.empty() && input.get_count() < 1) {
+    std::cout << "Input image required." << std::endl;
+    std::cout << parser.get_help() << std::endl;
+    exit(-1);
+  }
+  std::map<std::string, zz::Image::Interp> resize_modes = {
+    {"area", zz::Image::Interp::area}, {"bilinear", zz::Image::Interp::bilinear},
+    {"nearest", zz::Image::Interp::nearest}, {"filter", zz::Image::Interp::filter}};
+  if (resize_modes.find(resize_mode) == resize_modes.end()) {
+    std::cout << "Unknown resize mode: " << resize_mode << std::endl;
+    std::cout << parser.get_help() << std::endl;
+    exit(-1);
+  }
+
+  std::map<std::string, det::TensorLayout> layouts = {
+    {"nchw", det::TensorLayout::nchw}, {"nhwc", det::TensorLayout::nhwc}};
+  if (layouts.find(layout) == layouts.end()) {
+    std::cout << "Unknown layout: " << layout << std::endl;
+    std::cout << parser.get_help() << std::endl;
+    exit(-1);
+  }
+  std::map<std::string, det::MergeMode> merge_modes = {
+    {"wbf", det::MergeMode::wbf}, {"nms", det::MergeMode::nms}};
+  if (merge_modes.find(tta_merge) == merge_modes.end()) {
+    std::cout << "Unknown merge mode: " << tta_merge << std::endl;
+    std::cout << parser.get_help() << std::endl;
+    exit(-1);
+  }
+  if (pyramid_levels > 0 && !gate_model.empty()) {
+    std::cout << "--pyramid and --gate-model are exclusive" << std::endl;
+    exit(-1);
+  }
+  if (!stds.empty() && stds.size() != 3) {
+    std::cout << "--std takes red, green and blue std" << std::endl;
+    exit(-1);
+  }
+  if (!stds.empty() && scale != 0) {
+    std::cout << "--std and --scale are exclusive" << std::endl;
+    exit(-1);
+  }
+
+  zz::Image::set_decode_threads(decode_threads);
+  zz::Image::set_resize_threads(resize_threads);
+  zz::Image::set_max_pixels(max_pixels > 0 ? static_cast<std::size_t>(max_pixels) : 0);
 
   // create detector
   int device_type = 1;
@@ -70,21 +168,156 @@ int main(int argc, char **argv) {
   }
   det::Detector detector(model_prefix, epoch, width, height,
     mean_r, mean_g, mean_b, device_type, device_id);
+  detector.set_resize_interp(resize_modes[resize_mode]);
+  det::NormParams norm_params;
+  norm_params.mean[0] = mean_r;
+  norm_params.mean[1] = mean_g;
+  norm_params.mean[2] = mean_b;
+  det::Normalize norm = det::Normalize::mean;
+  if (!stds.empty()) {
+    for (int c = 0; c < 3; ++c) norm_params.std[c] = stds[c];
+    norm = det::Normalize::mean_std;
+  } else if (scale != 0) {
+    norm_params.scale = scale;
+    norm = det::Normalize::scale;
+  }
+  detector.set_input_format(layouts[layout], norm, norm_params);
+  det::Augmentation aug;
+  aug.flip = tta_flip;
+  aug.scales = tta_scales;
+  aug.merge = merge_modes[tta_merge];
+  aug.iou_thresh = tta_iou;
+  try {
+    detector.set_augmentation(aug);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    exit(-1);
+  }
 
-  // detect image
-  std::string img_file = input.get_value().str();
-  std::vector<float> dets = detector.detect(img_file);
-
-  if (dets.empty()) {
-    std::cout << "No detections found." << std::endl;
-    return 0;
+  // cheap first stage in front of the model, same input format
+  std::unique_ptr<det::Detector> gate_detector;
+  std::unique_ptr<det::Cascade> cascade;
+  if (!gate_model.empty()) {
+    gate_detector.reset(new det::Detector(gate_model, gate_epoch,
+      gate_width > 0 ? gate_width : width, gate_height > 0 ? gate_height : height,
+      mean_r, mean_g, mean_b, device_type, device_id));
+    gate_detector->set_resize_interp(resize_modes[resize_mode]);
+    gate_detector->set_input_format(layouts[layout], norm, norm_params);
+    det::CascadeConfig config;
+    config.gate_thresh = gate_thresh;
+    config.crops = !gate_whole;
+    cascade.reset(new det::Cascade(*gate_detector, detector, config));
   }
+  det::PyramidConfig pyramid;
+  pyramid.levels = pyramid_levels;
+  pyramid.overlap = tile_overlap;
+  auto detect_file = [&](const std::string &img_file) {
+    if (pyramid_levels > 0) {
+      zz::Image image(img_file.c_str());
+      return detector.detect_pyramid(image.view(), pyramid);
+    }
+    return cascade ? cascade->detect(img_file) : detector.detect(img_file);
+  };
+  auto detect_image = [&](const zz::Image &image) {
+    if (pyramid_levels > 0) return detector.detect_pyramid(image.view(), pyramid);
+    return cascade ? cascade->detect(image.view()) : detector.detect(image.view());
+  };
+  // one decode serves detection and drawing, the display resize happens when
+  // drawing. Tiles and cascade crops need full resolution, otherwise the
+  // smallest scale covering both network input and display is decoded
+  auto load_image = [&](const std::string &img_file) {
+    if (pyramid_levels > 0 || cascade) return det::load_display_image(img_file, -1);
+    int rows, cols;
+    detector.decode_size(rows, cols);
+    return det::load_display_image(img_file, max_disp_size, rows, cols);
+  };
 
   // load class names from text file if set
   if (!class_map_file.empty()) {
     class_names = det::load_class_map(class_map_file);
   }
 
+  // server mode, model stays resident until killed
+  if (!serve_socket.empty()) {
+    if (cache_size > 0) {
+      detector.enable_cache(static_cast<std::size_t>(cache_size) << 20);
+    }
+    det::BatchQueue queue(detector, max_batch > 0 ? max_batch : 1,
+      batch_wait > 0 ? batch_wait : 0);
+    det::Server server(detector, queue, class_names);
+    try {
+      server.serve(serve_socket);
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      exit(-1);
+    }
+    return 0;
+  }
+
+  std::vector<std::string> img_files;
+  input.get_value().load(img_files);
+
+  // multiple inputs, drawings are exported on a worker pool while detecting
+  if (img_files.size() > 1) {
+    if (!out_name.empty()) zz::os::create_directory_recursive(out_name);
+    if (!result_file.empty()) zz::os::create_directory_recursive(result_file);
+    std::unique_ptr<det::AnnotationExporter> exporter;
+    if (!out_name.empty()) {
+      exporter.reset(new det::AnnotationExporter(class_names, visu_thresh,
+        max_disp_size > 0 ? max_disp_size : 0, export_threads > 0 ? export_threads : 0));
+    }
+    std::size_t failures = 0;
+    for (const std::string &img_file : img_files) {
+      try {
+        std::vector<float> dets;
+        zz::Image image;
+        if (exporter) {
+          image = load_image(img_file);
+          dets = detect_image(image);
+        } else {
+          dets = detect_file(img_file);
+        }
+        if (!result_file.empty()) {
+          det::save_detection_results(zz::os::path_join({result_file,
+            zz::os::path_split_basename(img_file) + ".txt"}), dets, class_names);
+        }
+        if (exporter) {
+          exporter->submit(std::move(image), std::move(dets),
+            zz::os::path_join({out_name, zz::os::path_split_filename(img_file)}));
+        }
+      } catch (std::exception &e) {
+        std::cerr << img_file << ": " << e.what() << std::endl;
+        ++failures;
+      }
+    }
+    if (exporter) {
+      exporter->wait();
+      failures += exporter->failed();
+    }
+    return failures > 0 ? -1 : 0;
+  }
+
+  // detect image
+  std::string img_file = img_files[0];
+  std::vector<float> dets;
+  zz::Image image;
+  try {
+    if (max_disp_size > 0) {
+      image = load_image(img_file);
+      dets = detect_image(image);
+    } else {
+      dets = detect_file(img_file);
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    exit(-1);
+  }
+
+  if (dets.empty()) {
+    std::cout << "No detections found." << std::endl;
+    return 0;
+  }
+
   // save results
   if (!result_file.empty()) {
     det::save_detection_results(result_file, dets, class_names);
@@ -92,7 +325,7 @@ int main(int argc, char **argv) {
 
   // visualize detections
   if (max_disp_size > 0) {
-    det::visualize_detection(img_file, dets, visu_thresh, max_disp_size,
+    det::visualize_detection(std::move(image), dets, visu_thresh, max_disp_size,
       class_names, out_name);
   }
 
@@ -0,0 +1,286 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file preprocess.cpp
+ * \brief conversion of 8 bit images into network input tensors impl
+ */
+
+#include "preprocess.hpp"
+#include <cstring>
+#include <string>
+
+// sse2 is part of every x86-64 target, no runtime check needed
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DET_PREPROCESS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace det {
+NormParams::NormParams() : scale(1.f) {
+  for (int c = 0; c < 3; ++c) {
+    mean[c] = 0.f;
+    std[c] = 1.f;
+  }
+}
+
+int source_channels(PixelOrder order) {
+  switch (order) {
+    case PixelOrder::rgba: return 4;
+    case PixelOrder::gray: return 1;
+    default: return 3;
+  }
+}
+
+PixelOrder pixel_order(int channels) {
+  switch (channels) {
+    case 1: return PixelOrder::gray;
+    case 3: return PixelOrder::rgb;
+    case 4: return PixelOrder::rgba;
+    default: throw zz::ArgException("Unsupported number of channels: "
+      + std::to_string(channels));
+  }
+}
+
+namespace {
+// interleaved channels and where red, green and blue sit in a pixel
+template <PixelOrder Order> struct Source;
+template <> struct Source<PixelOrder::rgb> {
+  static const int channels = 3, r = 0, g = 1, b = 2;
+};
+template <> struct Source<PixelOrder::bgr> {
+  static const int channels = 3, r = 2, g = 1, b = 0;
+};
+template <> struct Source<PixelOrder::rgba> {
+  static const int channels = 4, r = 0, g = 1, b = 2;
+};
+template <> struct Source<PixelOrder::gray> {
+  static const int channels = 1, r = 0, g = 0, b = 0;
+};
+
+// x * mul - sub, constants are folded from params so every mode is one
+// multiply and/or one subtract, the unused one is never emitted
+template <Normalize Norm> struct Normalizer;
+template <> struct Normalizer<Normalize::mean> {
+  static float apply(float x, float, float sub) { return x - sub; }
+};
+template <> struct Normalizer<Normalize::mean_std> {
+  static float apply(float x, float mul, float sub) { return x * mul - sub; }
+};
+template <> struct Normalizer<Normalize::scale> {
+  static float apply(float x, float mul, float) { return x * mul; }
+};
+
+template <TensorLayout Layout> struct Store;
+template <> struct Store<TensorLayout::nchw> {
+  // row starts at out + y * cols, channels are plane apart
+  static void pixel(float *row, std::size_t plane, int x, float r, float g, float b) {
+    row[x] = r;
+    row[x + plane] = g;
+    row[x + 2 * plane] = b;
+  }
+};
+template <> struct Store<TensorLayout::nhwc> {
+  // row starts at out + y * cols * 3
+  static void pixel(float *row, std::size_t, int x, float r, float g, float b) {
+    row[3 * x] = r;
+    row[3 * x + 1] = g;
+    row[3 * x + 2] = b;
+  }
+};
+
+#ifdef DET_PREPROCESS_SSE2
+// four pixels into one float vector per source channel
+template <int Channels> struct Load4;
+template <> struct Load4<1> {
+  static void load(const unsigned char *p, __m128 *ch) {
+    int v;
+    std::memcpy(&v, p, 4);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i w = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+    ch[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero));
+  }
+};
+template <> struct Load4<3> {
+  static void load(const unsigned char *p, __m128 *ch) {
+    // exactly 12 bytes, never reads past the row
+    int v;
+    std::memcpy(&v, p + 8, 4);
+    __m128i bytes = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+                                       _mm_cvtsi32_si128(v));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    // a = c0 c1 c2 c0, b = c1 c2 c0 c1, c = c2 c0 c1 c2 of pixels 0..3
+    __m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    __m128 b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    __m128 c = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    ch[0] = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+    ch[1] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                           _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    ch[2] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                           _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+  }
+};
+template <> struct Load4<4> {
+  static void load(const unsigned char *p, __m128 *ch) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    ch[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    ch[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    ch[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    ch[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    _MM_TRANSPOSE4_PS(ch[0], ch[1], ch[2], ch[3]);
+  }
+};
+
+template <Normalize Norm> struct Normalizer4;
+template <> struct Normalizer4<Normalize::mean> {
+  static __m128 apply(__m128 x, __m128, __m128 sub) { return _mm_sub_ps(x, sub); }
+};
+template <> struct Normalizer4<Normalize::mean_std> {
+  static __m128 apply(__m128 x, __m128 mul, __m128 sub) {
+    return _mm_sub_ps(_mm_mul_ps(x, mul), sub);
+  }
+};
+template <> struct Normalizer4<Normalize::scale> {
+  static __m128 apply(__m128 x, __m128 mul, __m128) { return _mm_mul_ps(x, mul); }
+};
+
+template <TensorLayout Layout> struct Store4;
+template <> struct Store4<TensorLayout::nchw> {
+  static void pixels(float *row, std::size_t plane, int x, __m128 r, __m128 g, __m128 b) {
+    _mm_storeu_ps(row + x, r);
+    _mm_storeu_ps(row + x + plane, g);
+    _mm_storeu_ps(row + x + 2 * plane, b);
+  }
+};
+template <> struct Store4<TensorLayout::nhwc> {
+  static void pixels(float *row, std::size_t, int x, __m128 r, __m128 g, __m128 b) {
+    // r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+    __m128 rg = _mm_unpacklo_ps(r, g);
+    __m128 v0 = _mm_shuffle_ps(rg, _mm_shuffle_ps(b, r, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0));
+    __m128 v1 = _mm_shuffle_ps(_mm_shuffle_ps(g, b, _MM_SHUFFLE(1, 1, 1, 1)),
+                               _mm_shuffle_ps(r, g, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 v2 = _mm_shuffle_ps(_mm_shuffle_ps(b, r, _MM_SHUFFLE(3, 3, 2, 2)),
+                               _mm_shuffle_ps(g, b, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    float *p = row + 3 * x;
+    _mm_storeu_ps(p, v0);
+    _mm_storeu_ps(p + 4, v1);
+    _mm_storeu_ps(p + 8, v2);
+  }
+};
+
+inline __m128 reverse4(__m128 v) {
+  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+#endif
+}  // namespace
+
+template <PixelOrder Order, TensorLayout Layout, Normalize Norm, bool Mirror>
+void preprocess(const zz::ImageView<unsigned char> &image,
+                const NormParams &params, float *out) {
+  typedef Source<Order> Src;
+  if (image.channels() != Src::channels) {
+    throw zz::ArgException("Image has " + std::to_string(image.channels())
+      + " channels, pixel order needs " + std::to_string(Src::channels));
+  }
+  const int rows = image.rows();
+  const int cols = image.cols();
+  const std::size_t plane = static_cast<std::size_t>(rows) * cols;
+  const std::size_t row_step = Layout == TensorLayout::nchw ? cols : 3 * cols;
+
+  // (x - mean) / std as x * mul - sub
+  float mul[3];
+  float sub[3];
+  for (int c = 0; c < 3; ++c) {
+    mul[c] = Norm == Normalize::scale ? params.scale
+      : Norm == Normalize::mean_std ? 1.f / params.std[c] : 1.f;
+    sub[c] = Norm == Normalize::mean_std ? params.mean[c] / params.std[c] : params.mean[c];
+  }
+#ifdef DET_PREPROCESS_SSE2
+  const __m128 mul_r = _mm_set1_ps(mul[0]), mul_g = _mm_set1_ps(mul[1]), mul_b = _mm_set1_ps(mul[2]);
+  const __m128 sub_r = _mm_set1_ps(sub[0]), sub_g = _mm_set1_ps(sub[1]), sub_b = _mm_set1_ps(sub[2]);
+#endif
+
+  for (int y = 0; y < rows; ++y) {
+    const unsigned char *src = image.ptr(y);
+    float *row = out + y * row_step;
+    int x = 0;
+#ifdef DET_PREPROCESS_SSE2
+    for (; x + 4 <= cols; x += 4) {
+      __m128 ch[4];
+      Load4<Src::channels>::load(src + x * Src::channels, ch);
+      __m128 r = Normalizer4<Norm>::apply(ch[Src::r], mul_r, sub_r);
+      __m128 g = Normalizer4<Norm>::apply(ch[Src::g], mul_g, sub_g);
+      __m128 b = Normalizer4<Norm>::apply(ch[Src::b], mul_b, sub_b);
+      if (Mirror) {
+        // four pixels land reversed at the other end of the row
+        Store4<Layout>::pixels(row, plane, cols - 4 - x, reverse4(r), reverse4(g), reverse4(b));
+      } else {
+        Store4<Layout>::pixels(row, plane, x, r, g, b);
+      }
+    }
+#endif
+    for (; x < cols; ++x) {
+      const unsigned char *p = src + x * Src::channels;
+      Store<Layout>::pixel(row, plane, Mirror ? cols - 1 - x : x,
+        Normalizer<Norm>::apply(p[Src::r], mul[0], sub[0]),
+        Normalizer<Norm>::apply(p[Src::g], mul[1], sub[1]),
+        Normalizer<Norm>::apply(p[Src::b], mul[2], sub[2]));
+    }
+  }
+}
+
+#define DET_PREPROCESS_MIRRORS(order, layout, norm) \
+  template void preprocess<order, layout, norm, false>(const zz::ImageView<unsigned char>&, const NormParams&, float*); \
+  template void preprocess<order, layout, norm, true>(const zz::ImageView<unsigned char>&, const NormParams&, float*);
+#define DET_PREPROCESS_NORMS(order, layout) \
+  DET_PREPROCESS_MIRRORS(order, layout, Normalize::mean) \
+  DET_PREPROCESS_MIRRORS(order, layout, Normalize::mean_std) \
+  DET_PREPROCESS_MIRRORS(order, layout, Normalize::scale)
+#define DET_PREPROCESS_LAYOUTS(order) \
+  DET_PREPROCESS_NORMS(order, TensorLayout::nchw) \
+  DET_PREPROCESS_NORMS(order, TensorLayout::nhwc)
+
+DET_PREPROCESS_LAYOUTS(PixelOrder::rgb)
+DET_PREPROCESS_LAYOUTS(PixelOrder::bgr)
+DET_PREPROCESS_LAYOUTS(PixelOrder::rgba)
+DET_PREPROCESS_LAYOUTS(PixelOrder::gray)
+
+#undef DET_PREPROCESS_LAYOUTS
+#undef DET_PREPROCESS_NORMS
+#undef DET_PREPROCESS_MIRRORS
+
+namespace {
+template <PixelOrder Order, TensorLayout Layout, Normalize Norm>
+PreprocessKernel pick_mirror(bool mirror) {
+  return mirror ? preprocess<Order, Layout, Norm, true> : preprocess<Order, Layout, Norm, false>;
+}
+
+template <PixelOrder Order, TensorLayout Layout>
+PreprocessKernel pick_norm(Normalize norm, bool mirror) {
+  switch (norm) {
+    case Normalize::mean_std: return pick_mirror<Order, Layout, Normalize::mean_std>(mirror);
+    case Normalize::scale: return pick_mirror<Order, Layout, Normalize::scale>(mirror);
+    default: return pick_mirror<Order, Layout, Normalize::mean>(mirror);
+  }
+}
+
+template <PixelOrder Order>
+PreprocessKernel pick_layout(TensorLayout layout, Normalize norm, bool mirror) {
+  return layout == TensorLayout::nhwc ? pick_norm<Order, TensorLayout::nhwc>(norm, mirror)
+    : pick_norm<Order, TensorLayout::nchw>(norm, mirror);
+}
+}  // namespace
+
+PreprocessKernel preprocess_kernel(PixelOrder order, TensorLayout layout,
+                                   Normalize norm, bool mirror) {
+  switch (order) {
+    case PixelOrder::bgr: return pick_layout<PixelOrder::bgr>(layout, norm, mirror);
+    case PixelOrder::rgba: return pick_layout<PixelOrder::rgba>(layout, norm, mirror);
+    case PixelOrder::gray: return pick_layout<PixelOrder::gray>(layout, norm, mirror);
+    default: return pick_layout<PixelOrder::rgb>(layout, norm, mirror);
+  }
+}
+}  // namespace det
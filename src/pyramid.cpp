@@ -0,0 +1,113 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file pyramid.cpp
+ * \brief image pyramid of 2x box filtered levels for multi-scale detection impl
+ */
+
+#include "pyramid.hpp"
+#include <cstdint>
+#include <vector>
+
+// sse2 is part of every x86-64 target, no runtime check needed
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DET_PYRAMID_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace det {
+namespace {
+// sums of vertically adjacent bytes, 16 per step
+void add_rows(const unsigned char *a, const unsigned char *b, uint16_t *sum, int n) {
+  int i = 0;
+#ifdef DET_PYRAMID_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i + 8), hi);
+  }
+#endif
+  for (; i < n; ++i) sum[i] = static_cast<uint16_t>(a[i] + b[i]);
+}
+
+// pairs of horizontally adjacent pixels of a summed row, channels apart
+template <int C>
+void add_cols(const uint16_t *sum, unsigned char *dst, int src_cols, int dst_cols) {
+  int pairs = src_cols / 2;
+  for (int x = 0; x < pairs; ++x) {
+    const uint16_t *s = sum + 2 * x * C;
+    for (int c = 0; c < C; ++c) {
+      dst[x * C + c] = static_cast<unsigned char>((s[c] + s[C + c] + 2) >> 2);
+    }
+  }
+  if (dst_cols > pairs) {
+    const uint16_t *s = sum + 2 * pairs * C;
+    for (int c = 0; c < C; ++c) {
+      dst[pairs * C + c] = static_cast<unsigned char>((2 * s[c] + 2) >> 2);
+    }
+  }
+}
+
+template <int C>
+void downsample_rows(const zz::ImageView<unsigned char> &src,
+                     const zz::ImageView<unsigned char> &dst) {
+  std::vector<uint16_t> sum(static_cast<std::size_t>(src.cols()) * C);
+  for (int y = 0; y < dst.rows(); ++y) {
+    const unsigned char *a = src.ptr(2 * y);
+    const unsigned char *b = 2 * y + 1 < src.rows() ? src.ptr(2 * y + 1) : a;
+    add_rows(a, b, sum.data(), src.cols() * C);
+    add_cols<C>(sum.data(), dst.ptr(y), src.cols(), dst.cols());
+  }
+}
+}  // namespace
+
+void downsample_half(const zz::ImageView<unsigned char> &src,
+                     const zz::ImageView<unsigned char> &dst) {
+  if (dst.rows() != (src.rows() + 1) / 2 || dst.cols() != (src.cols() + 1) / 2 ||
+      dst.channels() != src.channels()) {
+    throw zz::ArgException("Destination must be half the source size");
+  }
+  switch (src.channels()) {
+    case 1: downsample_rows<1>(src, dst); break;
+    case 3: downsample_rows<3>(src, dst); break;
+    case 4: downsample_rows<4>(src, dst); break;
+    default: throw zz::ArgException("Unsupported number of channels");
+  }
+}
+
+void Pyramid::build(const zz::ImageView<unsigned char> &frame, int num_levels) {
+  if (frame.empty()) throw zz::ArgException("Unable to build pyramid of empty image");
+  if (num_levels < 1) throw zz::ArgException("Pyramid needs at least one level");
+  levels_.assign(1, frame);
+
+  // one block for all halved levels, each one below the other
+  int rows = 0;
+  int r = frame.rows();
+  int c = frame.cols();
+  for (int i = 1; i < num_levels && (r > 1 || c > 1); ++i) {
+    r = (r + 1) / 2;
+    c = (c + 1) / 2;
+    rows += r;
+  }
+  if (rows == 0) return;
+  int cols = (frame.cols() + 1) / 2;
+  if (storage_.rows() != rows || storage_.cols() != cols ||
+      storage_.channels() != frame.channels()) {
+    storage_.create(rows, cols, frame.channels());
+  }
+  zz::ImageView<unsigned char> block = storage_.view();
+  int offset = 0;
+  while (offset < rows) {
+    const zz::ImageView<unsigned char> &prev = levels_.back();
+    int level_rows = (prev.rows() + 1) / 2;
+    zz::ImageView<unsigned char> level(block.ptr(offset), level_rows, (prev.cols() + 1) / 2,
+                                       block.channels(), block.step());
+    downsample_half(prev, level);
+    levels_.push_back(level);
+    offset += level_rows;
+  }
+}
+}  // namespace det
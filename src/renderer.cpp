@@ -0,0 +1,172 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file renderer.cpp
+ * \brief headless drawing of detections into images impl
+ */
+
+#include "renderer.hpp"
+#include "CImg.h"
+#include <algorithm>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+namespace det {
+namespace {
+std::mutex atlas_mutex;
+std::map<int, std::unique_ptr<GlyphAtlas>> atlas_cache;
+
+// fill [x0, x1] x [y0, y1] inclusive, clipped to the image
+void fill_rect(unsigned char *data, int rows, int cols, int channels,
+               int x0, int y0, int x1, int y1, const unsigned char *color) {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, cols - 1);
+  y1 = std::min(y1, rows - 1);
+  int ch = std::min(channels, 3);
+  for (int y = y0; y <= y1; ++y) {
+    unsigned char *p = data + (static_cast<std::size_t>(y) * cols + x0) * channels;
+    for (int x = x0; x <= x1; ++x, p += channels) {
+      for (int k = 0; k < ch; ++k) p[k] = color[k];
+    }
+  }
+}
+}  // namespace
+
+GlyphAtlas::GlyphAtlas(int height) : height_(height), stride_(0) {
+  // masks of the native font follow its 256 color glyphs
+  const cimg_library::CImgList<unsigned char> &font =
+    cimg_library::CImgList<unsigned char>::font(height, true);
+  for (int c = 0; c < 256; ++c) {
+    offset_[c] = stride_;
+    width_[c] = font[c + 256].width();
+    stride_ += width_[c];
+  }
+  alpha_.assign(static_cast<std::size_t>(stride_) * height_, 0);
+  for (int c = 0; c < 256; ++c) {
+    const cimg_library::CImg<unsigned char> &glyph = font[c + 256];
+    int rows = std::min(glyph.height(), height_);
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < width_[c]; ++x) {
+        alpha_[y * stride_ + offset_[c] + x] = glyph(x, y);
+      }
+    }
+  }
+}
+
+const GlyphAtlas &GlyphAtlas::get(int height) {
+  std::lock_guard<std::mutex> lock(atlas_mutex);
+  std::unique_ptr<GlyphAtlas> &atlas = atlas_cache[height];
+  if (!atlas) atlas.reset(new GlyphAtlas(height));
+  return *atlas;
+}
+
+int GlyphAtlas::text_width(const std::string &text) const {
+  int w = 0;
+  for (char c : text) w += width_[static_cast<unsigned char>(c)];
+  return w;
+}
+
+Renderer::Renderer(std::vector<std::string> class_names, int font_size,
+                   int thickness)
+  : class_names_(class_names), atlas_(GlyphAtlas::get(font_size > 0 ? font_size : 20)),
+  thickness_(thickness > 0 ? thickness : 1) {
+  // random colors, one per class
+  std::size_t num_classes = std::max<std::size_t>(class_names_.size(), 1);
+  std::mt19937 rng(static_cast<unsigned int>(std::time(0)));
+  for (std::size_t c = 0; c < num_classes; ++c) {
+    std::array<unsigned char, 3> color;
+    for (int k = 0; k < 3; ++k) color[k] = static_cast<unsigned char>(rng() % 255);
+    colors_.push_back(color);
+  }
+}
+
+void Renderer::draw(zz::Image &img, const std::vector<float> &dets,
+                    float thresh) const {
+  if (img.empty()) return;
+  int width = img.cols();
+  int height = img.rows();
+  // id, score, xmin, ymin, xmax, ymax
+  for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+    if (dets[i] < 0) continue;  // not an object
+    int id = static_cast<int>(dets[i]);
+    float score = dets[i + 1];
+    if (score < thresh) continue;
+    int xmin = static_cast<int>(dets[i + 2] * width);
+    int ymin = static_cast<int>(dets[i + 3] * height);
+    int xmax = static_cast<int>(dets[i + 4] * width);
+    int ymax = static_cast<int>(dets[i + 5] * height);
+    const unsigned char *color = colors_[0].data();
+    std::ostringstream ss;
+    ss.precision(4);
+    ss << score;
+    std::string text = ss.str();
+    if (id < static_cast<int>(class_names_.size())) {
+      color = colors_[id].data();
+      text = class_names_[id] + ": " + text;
+    }
+    draw_box(img, xmin, ymin, xmax, ymax, color);
+    // label sits on top of the box, kept inside the image
+    draw_label(img, xmin, std::max(ymin - atlas_.height(), 0), text, color);
+  }
+}
+
+void Renderer::draw_box(zz::Image &img, int x0, int y0, int x1, int y1,
+                        const unsigned char *color) const {
+  if (img.empty()) return;
+  unsigned char *data = &img(0, 0, 0);  // detaches shared pixels
+  int rows = img.rows();
+  int cols = img.cols();
+  int channels = img.channels();
+  int outside = (thickness_ - 1) / 2;
+  int inside = thickness_ - 1 - outside;
+  fill_rect(data, rows, cols, channels, x0 - outside, y0 - outside, x0 + inside, y1 + outside, color);  // left
+  fill_rect(data, rows, cols, channels, x0 - outside, y0 - outside, x1 + outside, y0 + inside, color);  // top
+  fill_rect(data, rows, cols, channels, x1 - outside, y0 - outside, x1 + inside, y1 + outside, color);  // right
+  fill_rect(data, rows, cols, channels, x0 - outside, y1 - outside, x1 + outside, y1 + inside, color);  // bot
+}
+
+void Renderer::draw_label(zz::Image &img, int x, int y, const std::string &text,
+                          const unsigned char *bg_color) const {
+  if (img.empty() || text.empty()) return;
+  unsigned char *data = &img(0, 0, 0);  // detaches shared pixels
+  int rows = img.rows();
+  int cols = img.cols();
+  int channels = img.channels();
+  int ch = std::min(channels, 3);
+  int y0 = std::max(y, 0);
+  int y1 = std::min(y + atlas_.height(), rows);
+
+  // background at half opacity
+  int x0 = std::max(x, 0);
+  int x1 = std::min(x + atlas_.text_width(text), cols);
+  for (int r = y0; r < y1; ++r) {
+    unsigned char *p = data + (static_cast<std::size_t>(r) * cols + x0) * channels;
+    for (int c = x0; c < x1; ++c, p += channels) {
+      for (int k = 0; k < ch; ++k) p[k] = static_cast<unsigned char>((p[k] + bg_color[k]) >> 1);
+    }
+  }
+
+  // white glyphs blended by their coverage
+  for (char t : text) {
+    unsigned char g = static_cast<unsigned char>(t);
+    int w = atlas_.width(g);
+    const unsigned char *mask = atlas_.mask(g);
+    int c0 = std::max(x, 0);
+    int c1 = std::min(x + w, cols);
+    for (int r = y0; r < y1; ++r) {
+      const unsigned char *m = mask + (r - y) * atlas_.stride() + (c0 - x);
+      unsigned char *p = data + (static_cast<std::size_t>(r) * cols + c0) * channels;
+      for (int c = c0; c < c1; ++c, ++m, p += channels) {
+        if (!*m) continue;
+        for (int k = 0; k < ch; ++k) p[k] = static_cast<unsigned char>(p[k] + ((255 - p[k]) * *m + 127) / 255);
+      }
+    }
+    x += w;
+    if (x >= cols) break;
+  }
+}
+}  // namespace det
@@ -0,0 +1,171 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file result_cache.cpp
+ * \brief content addressed detection result cache impl
+ */
+
+#include "result_cache.hpp"
+#include <cstring>
+
+namespace det {
+namespace {
+const uint64_t kPrime1 = 11400714785074694791ULL;
+const uint64_t kPrime2 = 14029467366897019727ULL;
+const uint64_t kPrime3 = 1609587929392839161ULL;
+const uint64_t kPrime4 = 9650029242287828579ULL;
+const uint64_t kPrime5 = 2870177450012600261ULL;
+
+inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char *p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));  // little endian host assumed
+  return v;
+}
+
+inline uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = rotl64(acc, 31);
+  return acc * kPrime1;
+}
+
+inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+  acc ^= xxh_round(0, val);
+  return acc * kPrime1 + kPrime4;
+}
+}  // namespace
+
+uint64_t hash_bytes(const void *data, std::size_t len, uint64_t seed) {
+  const unsigned char *p = static_cast<const unsigned char*>(data);
+  const unsigned char *end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    const unsigned char *limit = end - 32;
+    uint64_t v1 = seed + kPrime1 + kPrime2;
+    uint64_t v2 = seed + kPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kPrime1;
+    do {
+      v1 = xxh_round(v1, read64(p)); p += 8;
+      v2 = xxh_round(v2, read64(p)); p += 8;
+      v3 = xxh_round(v3, read64(p)); p += 8;
+      v4 = xxh_round(v4, read64(p)); p += 8;
+    } while (p <= limit);
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxh_merge(h, v1);
+    h = xxh_merge(h, v2);
+    h = xxh_merge(h, v3);
+    h = xxh_merge(h, v4);
+  } else {
+    h = seed + kPrime5;
+  }
+
+  h += static_cast<uint64_t>(len);
+  while (p + 8 <= end) {
+    h ^= xxh_round(0, read64(p));
+    h = rotl64(h, 27) * kPrime1 + kPrime4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+    h = rotl64(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  while (p < end) {
+    h ^= (*p) * kPrime5;
+    h = rotl64(h, 11) * kPrime1;
+    ++p;
+  }
+
+  // avalanche
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+ResultCache::ResultCache(std::size_t max_bytes)
+  : max_bytes_(max_bytes), bytes_(0), hits_(0), misses_(0) {
+}
+
+std::size_t ResultCache::entry_bytes(const std::vector<float> &result) {
+  // payload plus rough bookkeeping overhead of list node and hash bucket
+  return result.size() * sizeof(float) + sizeof(Entry) + 64;
+}
+
+bool ResultCache::get(uint64_t key, std::vector<float> &result) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  result = it->second->second;
+  ++hits_;
+  return true;
+}
+
+void ResultCache::put(uint64_t key, const std::vector<float> &result) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t nbytes = entry_bytes(result);
+  if (nbytes > max_bytes_) return;  // would never fit
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    bytes_ -= entry_bytes(it->second->second);
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+  lru_.push_front(Entry(key, result));
+  index_[key] = lru_.begin();
+  bytes_ += nbytes;
+  evict();
+}
+
+void ResultCache::evict() {
+  while (bytes_ > max_bytes_ && !lru_.empty()) {
+    const Entry &last = lru_.back();
+    bytes_ -= entry_bytes(last.second);
+    index_.erase(last.first);
+    lru_.pop_back();
+  }
+}
+
+void ResultCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  lru_.clear();
+  index_.clear();
+  bytes_ = 0;
+}
+
+std::size_t ResultCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+std::size_t ResultCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+std::size_t ResultCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lru_.size();
+}
+
+std::size_t ResultCache::bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+}  // namespace det
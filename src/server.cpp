@@ -0,0 +1,262 @@
+/*!
+ *  Copyright (c) 2015 by Joshua Zhang
+ * \file server.cpp
+ * \brief long running detection server impl
+ */
+
+#include "server.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace det {
+namespace {
+const uint32_t kRequestMagic = 0x51445353;  // "SSDQ"
+const uint32_t kResponseMagic = 0x52445353;  // "SSDR"
+const std::size_t kRequestHeaderSize = 24;
+enum Status { kOk = 0, kBadRequest = 1, kFailed = 2 };
+enum Kind { kEncoded = 0, kRawFrame = 1 };
+enum Reply { kBinary = 0, kJson = 1 };
+
+class BadRequest : public zz::ArgException {
+ public:
+  explicit BadRequest(const std::string &msg) : zz::ArgException(msg) {}
+};
+
+inline uint32_t get_u32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void put_u32(unsigned char *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+#ifndef _WIN32
+bool read_full(int fd, unsigned char *buf, std::size_t len) {
+  while (len > 0) {
+    ssize_t n = ::read(fd, buf, len);
+    if (n <= 0) return false;
+    buf += n;
+    len -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool write_full(int fd, const unsigned char *buf, std::size_t len) {
+  while (len > 0) {
+    ssize_t n = ::send(fd, buf, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    buf += n;
+    len -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool send_response(int fd, uint32_t status, const std::string &body) {
+  unsigned char header[12];
+  put_u32(header, kResponseMagic);
+  put_u32(header + 4, status);
+  put_u32(header + 8, static_cast<uint32_t>(body.size()));
+  return write_full(fd, header, sizeof(header)) &&
+    write_full(fd, reinterpret_cast<const unsigned char*>(body.data()), body.size());
+}
+#endif
+
+std::string json_escape(const std::string &s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out.push_back(' ');
+    } else {
+      out.push_back(c);
+    }
+  }
+  return out;
+}
+}  // namespace
+
+Server::Server(Detector &detector, BatchQueue &queue,
+               std::vector<std::string> class_names, unsigned int num_workers)
+  : detector_(detector), queue_(queue), class_names_(class_names),
+  num_workers_(num_workers > 0 ? num_workers : 1),
+  max_payload_(64 << 20), listen_fd_(-1) {
+}
+
+std::string Server::format_json(const std::vector<float> &dets) const {
+  std::ostringstream ss;
+  ss << "{\"detections\":[";
+  bool first = true;
+  for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+    if (dets[i] < 0) continue;  // not an object
+    int id = static_cast<int>(dets[i]);
+    if (!first) ss << ",";
+    first = false;
+    ss << "{\"id\":" << id;
+    if (id < static_cast<int>(class_names_.size())) {
+      ss << ",\"class\":\"" << json_escape(class_names_[id]) << "\"";
+    }
+    ss << ",\"score\":" << dets[i + 1]
+      << ",\"xmin\":" << dets[i + 2] << ",\"ymin\":" << dets[i + 3]
+      << ",\"xmax\":" << dets[i + 4] << ",\"ymax\":" << dets[i + 5] << "}";
+  }
+  ss << "]}";
+  return ss.str();
+}
+
+std::vector<float> Server::run(int kind, unsigned int rows, unsigned int cols,
+                               unsigned int channels,
+                               std::vector<unsigned char> &payload) {
+  zz::Image image;
+  if (kind == kRawFrame) {
+    if (rows < 1 || cols < 1 || channels < 1 ||
+        static_cast<uint64_t>(rows) * cols * channels != payload.size()) {
+      throw BadRequest("Raw frame size does not match payload length");
+    }
+    // scale straight from the payload, the full size frame is never copied
+    zz::ImageView<unsigned char> frame(payload.data(), rows, cols, channels);
+    if (static_cast<int>(rows) == detector_.input_height() &&
+        static_cast<int>(cols) == detector_.input_width()) {
+      image.import(frame);
+    } else {
+      image.resize_from(frame, detector_.input_height(), detector_.input_width(),
+                        detector_.resize_interp());
+    }
+    return queue_.submit(std::move(image)).get();
+  }
+  if (kind != kEncoded) throw BadRequest("Unknown request kind");
+
+  // identical uploads are answered from cache without decoding
+  ResultCache *cache = detector_.cache();
+  uint64_t key = 0;
+  std::vector<float> dets;
+  if (cache) {
+    key = detector_.content_key(payload.data(), payload.size());
+    if (cache->get(key, dets)) return dets;
+  }
+  image = detector_.decode_input(payload.data(), payload.size());
+  dets = queue_.submit(std::move(image)).get();
+  if (cache) cache->put(key, dets);
+  return dets;
+}
+
+#ifndef _WIN32
+void Server::handle_connection(int fd) {
+  auto logger = zz::log::get_logger("default");
+  unsigned char header[kRequestHeaderSize];
+  std::vector<unsigned char> payload;
+  while (read_full(fd, header, sizeof(header))) {
+    if (get_u32(header) != kRequestMagic) {
+      send_response(fd, kBadRequest, "bad magic");
+      break;  // stream is out of sync, drop connection
+    }
+    int kind = header[4];
+    int reply = header[5];
+    uint32_t rows = get_u32(header + 8);
+    uint32_t cols = get_u32(header + 12);
+    uint32_t channels = get_u32(header + 16);
+    uint32_t length = get_u32(header + 20);
+    if (length > max_payload_) {
+      send_response(fd, kBadRequest, "payload too large");
+      break;
+    }
+    payload.resize(length);
+    if (!read_full(fd, payload.data(), length)) break;
+
+    uint32_t status = kOk;
+    std::string body;
+    std::vector<float> dets;
+    try {
+      dets = run(kind, rows, cols, channels, payload);
+    } catch (BadRequest &e) {
+      status = kBadRequest;
+      body = e.what();
+    } catch (std::exception &e) {
+      status = kFailed;
+      body = e.what();
+    }
+
+    if (status != kOk) {
+      logger->warn("Request failed: ") << body;
+      if (reply == kJson) body = "{\"error\":\"" + json_escape(body) + "\"}";
+    } else if (reply == kJson) {
+      body = format_json(dets);
+    } else {
+      for (std::size_t i = 0; i + 5 < dets.size(); i += 6) {
+        if (dets[i] < 0) continue;
+        body.append(reinterpret_cast<const char*>(&dets[i]), 6 * sizeof(float));
+      }
+    }
+    if (!send_response(fd, status, body)) break;
+  }
+  ::close(fd);
+}
+
+void Server::serve(std::string socket_path) {
+  auto logger = zz::log::get_logger("default");
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    throw zz::ArgException("Socket path too long: " + socket_path);
+  }
+  std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) throw zz::IOException("Unable to create socket");
+  ::unlink(socket_path.c_str());
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      ::listen(fd, 64) < 0) {
+    ::close(fd);
+    throw zz::IOException("Unable to listen on socket: " + socket_path);
+  }
+  listen_fd_ = fd;
+  logger->info("Serving detections on ") << socket_path;
+
+  {
+    zz::cds::ThreadPool workers(num_workers_);
+    while (true) {
+      int conn = ::accept(fd, NULL, NULL);
+      if (conn < 0) {
+        if (listen_fd_ < 0) break;  // stopped
+        if (errno == EINTR) continue;
+        logger->error("Accept failed, errno: ") << errno;
+        break;
+      }
+      workers.post([this, conn]() { handle_connection(conn); });
+    }
+  }  // wait for open connections
+  int old = listen_fd_.exchange(-1);
+  if (old >= 0) ::close(old);
+  ::unlink(socket_path.c_str());
+}
+
+void Server::stop() {
+  int fd = listen_fd_.exchange(-1);
+  if (fd >= 0) {
+    ::shutdown(fd, SHUT_RDWR);
+    ::close(fd);
+  }
+}
+#else
+void Server::handle_connection(int fd) {
+}
+
+void Server::serve(std::string socket_path) {
+  throw zz::RuntimeException("Server mode requires unix domain sockets");
+}
+
+void Server::stop() {
+}
+#endif
+}  // namespace det
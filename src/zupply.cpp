@@ -95,6 +95,9 @@
 #include <cstring>
 #include <deque>
 #include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
 
 // UTF8CPP
 #include <stdexcept>
@@ -838,6 +841,33 @@ namespace zz
 				// for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+				// extra decode options, zero initialize for defaults
+				typedef struct
+				{
+					// JPEG only: decode at the smallest 1/1, 1/2, 1/4 or 1/8 scale that is still
+					// at least min_x by min_y, by running a reduced size IDCT on each block.
+					// Other formats are loaded at full size. 0 ignores an axis.
+					int min_x, min_y;
+					// JPEG only: called once with final size to get the output buffer of
+					// x*y*comp bytes, so pixels are written straight into caller storage.
+					// If the returned pointer equals the buffer handed out it must not be
+					// freed with stbi_image_free. Other formats still use malloc.
+					stbi_uc *(*alloc)(void *user, int x, int y, int comp);
+					void *alloc_user;
+					// If set, rows of the final x*y image are handed to row() top to bottom
+					// instead of being kept. Baseline JPEG rows are converted while the scan
+					// is decoded, holding only a few MCU rows of component data; other
+					// formats are decoded fully first. alloc and vertical flip are ignored,
+					// the returned pointer is scratch space, free it with stbi_image_free.
+					void (*row)(void *user, int y, int x_size, int y_size, int comp, stbi_uc const *pixels);
+					void *row_user;
+				} stbi_load_options;
+
+				stbi_uc *stbi_load_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt);
+#ifndef STBI_NO_STDIO
+				stbi_uc *stbi_load_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt);
+#endif
+
 #ifndef STBI_NO_LINEAR
 				float *stbi_loadf(char const *filename, int *x, int *y, int *comp, int req_comp);
 				float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
@@ -898,6 +928,11 @@ namespace zz
 				// flip the image vertically, so the first pixel in the output array is the bottom left
 				void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+				// decode baseline jpegs that have restart markers on up to n threads, splitting
+				// the entropy coded data at the markers. Only for in-memory sources, others and
+				// jpegs without restart markers decode serially. Default 1.
+				void stbi_set_jpeg_decode_threads(int n);
+
 				// ZLIB client - used by PNG, available for other purposes
 
 				char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -1054,7 +1089,7 @@ namespace zz
 #define STBI_NO_SIMD
 #endif
 
-#if !defined(STBI_NO_SIMD) && defined(STBI__X86_TARGET)
+#if !defined(STBI_NO_SIMD) && (defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET))
 #define STBI_SSE2
 #include <emmintrin.h>
 
@@ -1102,6 +1137,35 @@ namespace zz
 					return 0;
 #endif
 				}
+#endif
+
+				// AVX2 kernels are compiled for AVX2 regardless of build flags and only
+				// picked at runtime if the cpu has it, so one binary runs everywhere
+#if !defined(STBI_NO_AVX2) && (defined(_MSC_VER) && _MSC_VER >= 1700 || defined(__clang__) || defined(__GNUC__) && (__GNUC__ * 100 + __GNUC_MINOR__) >= 409)
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI_AVX2_TARGET
+				int stbi__avx2_available()
+				{
+					int info[4];
+					__cpuid(info, 0);
+					if (info[0] < 7) return 0;
+					__cpuid(info, 1);
+					// os saves ymm state (osxsave + avx), then avx2 feature bit
+					if ((info[2] & 0x18000000) != 0x18000000) return 0;
+					if ((_xgetbv(0) & 6) != 6) return 0;
+					__cpuidex(info, 7, 0);
+					return ((info[1] >> 5) & 1) != 0;
+				}
+#else
+#define STBI_AVX2_TARGET __attribute__((target("avx2")))
+				int stbi__avx2_available()
+				{
+					return __builtin_cpu_supports("avx2");
+				}
+#endif
 #endif
 #endif
 
@@ -1140,6 +1204,13 @@ namespace zz
 
 					stbi_uc *img_buffer, *img_buffer_end;
 					stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+					int jpeg_min_x, jpeg_min_y; // requested minimum size for scaled jpeg decode, 0 for full size
+					stbi_uc *(*out_alloc)(void *user, int x, int y, int comp); // jpeg output buffer provider, NULL for malloc
+					void *out_alloc_user;
+					void (*row_cb)(void *user, int y, int x_size, int y_size, int comp, stbi_uc const *pixels); // row sink, NULL to keep the image
+					void *row_user;
+					int rows_sent; // set once the decoder handed out rows itself
 				} stbi__context;
 
 
@@ -1150,6 +1221,10 @@ namespace zz
 				{
 					s->io.read = NULL;
 					s->read_from_callbacks = 0;
+					s->jpeg_min_x = s->jpeg_min_y = 0;
+					s->out_alloc = NULL;
+					s->row_cb = NULL;
+					s->rows_sent = 0;
 					s->img_buffer = s->img_buffer_original = (stbi_uc *)buffer;
 					s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *)buffer + len;
 				}
@@ -1161,6 +1236,10 @@ namespace zz
 					s->io_user_data = user;
 					s->buflen = sizeof(s->buffer_start);
 					s->read_from_callbacks = 1;
+					s->jpeg_min_x = s->jpeg_min_y = 0;
+					s->out_alloc = NULL;
+					s->row_cb = NULL;
+					s->rows_sent = 0;
 					s->img_buffer_original = s->buffer_start;
 					stbi__refill_buffer(s);
 					s->img_buffer_original_end = s->img_buffer_end;
@@ -1262,8 +1341,9 @@ namespace zz
 				int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
-				// this is not threadsafe
-				const char *stbi__g_failure_reason;
+				// last failure of any thread; atomic because restart segment workers
+				// fail inside the shared block decoder, their caller reports last
+				std::atomic<const char *> stbi__g_failure_reason(nullptr);
 
 				const char *stbi_failure_reason(void)
 				{
@@ -1316,6 +1396,13 @@ namespace zz
 					stbi__vertically_flip_on_load = flag_true_if_should_flip;
 				}
 
+				std::atomic<int> stbi__jpeg_decode_threads(1);
+
+				void stbi_set_jpeg_decode_threads(int n)
+				{
+					stbi__jpeg_decode_threads = n > 0 ? n : 1;
+				}
+
 				unsigned char *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 				{
 #ifndef STBI_NO_JPEG
@@ -1457,6 +1544,58 @@ namespace zz
 					return stbi__load_flip(&s, x, y, comp, req_comp);
 				}
 
+				void stbi__apply_options(stbi__context *s, stbi_load_options const *opt)
+				{
+					if (!opt) return;
+					s->jpeg_min_x = opt->min_x;
+					s->jpeg_min_y = opt->min_y;
+					s->out_alloc = opt->alloc;
+					s->out_alloc_user = opt->alloc_user;
+					s->row_cb = opt->row;
+					s->row_user = opt->row_user;
+					if (s->row_cb) s->out_alloc = NULL;
+				}
+
+				// hand a fully decoded image to the row callback unless the decoder already did
+				void stbi__send_rows(stbi__context *s, stbi_uc *result, int x, int y, int comp, int req_comp)
+				{
+					int j, n = req_comp ? req_comp : comp;
+					if (!result || !s->row_cb || s->rows_sent) return;
+					for (j = 0; j < y; ++j)
+						s->row_cb(s->row_user, j, x, y, n, result + (size_t)j * x * n);
+				}
+
+				stbi_uc *stbi_load_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+				{
+					stbi__context s;
+					stbi_uc *result;
+					int n = 0;
+					stbi__start_mem(&s, buffer, len);
+					stbi__apply_options(&s, opt);
+					result = stbi__load_flip(&s, x, y, &n, req_comp);
+					if (comp) *comp = n;
+					stbi__send_rows(&s, result, *x, *y, n, req_comp);
+					return result;
+				}
+
+#ifndef STBI_NO_STDIO
+				stbi_uc *stbi_load_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+				{
+					FILE *f = stbi__fopen(filename, "rb");
+					unsigned char *result;
+					stbi__context s;
+					int n = 0;
+					if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+					stbi__start_file(&s, f);
+					stbi__apply_options(&s, opt);
+					result = stbi__load_flip(&s, x, y, &n, req_comp);
+					if (comp) *comp = n;
+					stbi__send_rows(&s, result, *x, *y, n, req_comp);
+					fclose(f);
+					return result;
+				}
+#endif
+
 #ifndef STBI_NO_LINEAR
 				float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 				{
@@ -1848,6 +1987,19 @@ namespace zz
 					int    delta[17];   // old 'firstsymbol' - old 'firstcode'
 				} stbi__huffman;
 
+				typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
+					int w, int hs);
+
+				typedef struct
+				{
+					resample_row_func resample;
+					stbi_uc *line0, *line1;
+					int hs, vs;   // expansion factor in each axis
+					int w_lores; // horizontal pixels pre-expansion
+					int ystep;   // how far through vertical expansion we are
+					int ypos;    // which pre-expansion row we're on
+				} stbi__resample;
+
 				typedef struct
 				{
 					stbi__context *s;
@@ -1893,6 +2045,18 @@ namespace zz
 					int scan_n, order[4];
 					int restart_interval, todo;
 
+					// dct domain downscaling, blocks decode to block_size^2 = (8 >> scale_shift)^2 pixels
+					int scale_shift, block_size;
+
+					// output stage. Component planes hold plane_mcu_rows MCU rows, a ring of a
+					// few rows when streaming, so rows are converted while the scan is decoded
+					int plane_mcu_rows;
+					int stream;
+					int req_comp, out_n, decode_n;
+					unsigned int out_row;     // next output row to convert
+					stbi_uc *output, *tail;   // whole image, or a single row with a row callback
+					stbi__resample res_comp[4];
+
 					// kernels
 					void(*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
 					void(*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2417,6 +2581,55 @@ namespace zz
 					}
 				}
 
+				// reduced size IDCT for decoding at 1/2, 1/4 scale: only the n x n lowest
+				// frequencies are used and an n-point inverse transform gives n x n pixels,
+				// m[x*n+u] = C(u)/2 * cos((2x+1)u*pi/2n) scaled by 1<<12
+				static const int stbi__idct_m4[16] = {
+					stbi__f2f(0.35355339f), stbi__f2f(0.46193977f), stbi__f2f(0.35355339f), stbi__f2f(0.19134172f),
+					stbi__f2f(0.35355339f), stbi__f2f(0.19134172f), -stbi__f2f(0.35355339f), -stbi__f2f(0.46193977f),
+					stbi__f2f(0.35355339f), -stbi__f2f(0.19134172f), -stbi__f2f(0.35355339f), stbi__f2f(0.46193977f),
+					stbi__f2f(0.35355339f), -stbi__f2f(0.46193977f), stbi__f2f(0.35355339f), -stbi__f2f(0.19134172f) };
+				static const int stbi__idct_m2[4] = {
+					stbi__f2f(0.35355339f), stbi__f2f(0.35355339f),
+					stbi__f2f(0.35355339f), -stbi__f2f(0.35355339f) };
+
+				void stbi__idct_scaled(stbi_uc *out, int out_stride, const short *data, const int *m, int n)
+				{
+					int i, j, k, val[16];
+					// columns, keep 2 extra bits of precision like the full size version
+					for (j = 0; j < n; ++j) {
+						for (i = 0; i < n; ++i) {
+							int t = 512;
+							for (k = 0; k < n; ++k) t += m[j * n + k] * data[k * 8 + i];
+							val[j * n + i] = t >> 10;
+						}
+					}
+					// rows, remove 1<<12 and the 1<<2 from above, round and level shift
+					for (j = 0; j < n; ++j, out += out_stride) {
+						for (i = 0; i < n; ++i) {
+							int t = (1 << 13) + (128 << 14);
+							for (k = 0; k < n; ++k) t += m[i * n + k] * val[j * n + k];
+							out[i] = stbi__clamp(t >> 14);
+						}
+					}
+				}
+
+				void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+				{
+					stbi__idct_scaled(out, out_stride, data, stbi__idct_m4, 4);
+				}
+
+				void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+				{
+					stbi__idct_scaled(out, out_stride, data, stbi__idct_m2, 2);
+				}
+
+				// 1/8 scale, every block is just its DC term
+				void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+				{
+					out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+				}
+
 #ifdef STBI_SSE2
 				// sse2 integer IDCT. not the fastest possible implementation but it
 				// produces bit-identical results to the generic C version so it's
@@ -2457,8 +2670,7 @@ namespace zz
 
 					// butterfly a/b, add bias, then shift by "s" and pack
 #define dct_bfly32o(out0, out1, a,b,bias,s) \
-					{
-					\
+					{ \
 						__m128i abiased_l = _mm_add_epi32(a##_l, bias); \
 						__m128i abiased_h = _mm_add_epi32(a##_h, bias); \
 						dct_wadd(sum, abiased, b); \
@@ -2480,8 +2692,7 @@ namespace zz
 	b = _mm_unpackhi_epi16(tmp, b)
 
 #define dct_pass(bias,shift) \
-					{
-						\
+					{ \
 						/* even part */ \
 						dct_rot(t2e, t3e, row2, row6, rot0_0, rot0_1); \
 						__m128i sum04 = _mm_add_epi16(row0, row4); \
@@ -2600,6 +2811,170 @@ namespace zz
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+				// avx2 version of the sse2 IDCT above, bit-identical. Every 32-bit
+				// intermediate row fits a single ymm, halving the multiply-add work;
+				// transposes stay in 128-bit registers.
+				STBI_AVX2_TARGET
+				void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[64])
+				{
+					__m128i row0, row1, row2, row3, row4, row5, row6, row7;
+					__m128i tmp;
+
+					// dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+					// out(0) = c0[even]*x + c0[odd]*y for all 8 columns (c0, x, y 16-bit, out 32-bit)
+					// out(1) = c1[even]*x + c1[odd]*y
+#define dct_rot(out0,out1, x,y,c0,c1) \
+	__m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x), (y))), _mm_unpackhi_epi16((x), (y)), 1); \
+	__m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+	__m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+					// out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in) \
+	__m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+#define dct_wadd(out, a, b) \
+	__m256i out = _mm256_add_epi32(a, b)
+
+#define dct_wsub(out, a, b) \
+	__m256i out = _mm256_sub_epi32(a, b)
+
+					// butterfly a/b, add bias, then shift by "s" and pack
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+	{ \
+		__m256i abiased = _mm256_add_epi32(a, bias); \
+		__m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+		__m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+		out0 = _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)); \
+		out1 = _mm_packs_epi32(_mm256_castsi256_si128(dif), _mm256_extracti128_si256(dif, 1)); \
+	}
+
+#define dct_interleave8(a, b) \
+	tmp = a; \
+	a = _mm_unpacklo_epi8(a, b); \
+	b = _mm_unpackhi_epi8(tmp, b)
+
+#define dct_interleave16(a, b) \
+	tmp = a; \
+	a = _mm_unpacklo_epi16(a, b); \
+	b = _mm_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+	{ \
+		/* even part */ \
+		dct_rot(t2e, t3e, row2, row6, rot0_0, rot0_1); \
+		__m128i sum04 = _mm_add_epi16(row0, row4); \
+		__m128i dif04 = _mm_sub_epi16(row0, row4); \
+		dct_widen(t0e, sum04); \
+		dct_widen(t1e, dif04); \
+		dct_wadd(x0, t0e, t3e); \
+		dct_wsub(x3, t0e, t3e); \
+		dct_wadd(x1, t1e, t2e); \
+		dct_wsub(x2, t1e, t2e); \
+		/* odd part */ \
+		dct_rot(y0o, y2o, row7, row3, rot2_0, rot2_1); \
+		dct_rot(y1o, y3o, row5, row1, rot3_0, rot3_1); \
+		__m128i sum17 = _mm_add_epi16(row1, row7); \
+		__m128i sum35 = _mm_add_epi16(row3, row5); \
+		dct_rot(y4o, y5o, sum17, sum35, rot1_0, rot1_1); \
+		dct_wadd(x4, y0o, y4o); \
+		dct_wadd(x5, y1o, y5o); \
+		dct_wadd(x6, y2o, y5o); \
+		dct_wadd(x7, y3o, y4o); \
+		dct_bfly32o(row0, row7, x0, x7, bias, shift); \
+		dct_bfly32o(row1, row6, x1, x6, bias, shift); \
+		dct_bfly32o(row2, row5, x2, x5, bias, shift); \
+		dct_bfly32o(row3, row4, x3, x4, bias, shift); \
+	}
+
+					__m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+					__m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+					__m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+					__m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+					__m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+					__m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+					__m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+					__m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+					// rounding biases in column/row passes, see stbi__idct_block for explanation.
+					__m256i bias_0 = _mm256_set1_epi32(512);
+					__m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+					// load
+					row0 = _mm_load_si128((const __m128i *) (data + 0 * 8));
+					row1 = _mm_load_si128((const __m128i *) (data + 1 * 8));
+					row2 = _mm_load_si128((const __m128i *) (data + 2 * 8));
+					row3 = _mm_load_si128((const __m128i *) (data + 3 * 8));
+					row4 = _mm_load_si128((const __m128i *) (data + 4 * 8));
+					row5 = _mm_load_si128((const __m128i *) (data + 5 * 8));
+					row6 = _mm_load_si128((const __m128i *) (data + 6 * 8));
+					row7 = _mm_load_si128((const __m128i *) (data + 7 * 8));
+
+					// column pass
+					dct_pass(bias_0, 10);
+
+					{
+						// 16bit 8x8 transpose
+						dct_interleave16(row0, row4);
+						dct_interleave16(row1, row5);
+						dct_interleave16(row2, row6);
+						dct_interleave16(row3, row7);
+
+						dct_interleave16(row0, row2);
+						dct_interleave16(row1, row3);
+						dct_interleave16(row4, row6);
+						dct_interleave16(row5, row7);
+
+						dct_interleave16(row0, row1);
+						dct_interleave16(row2, row3);
+						dct_interleave16(row4, row5);
+						dct_interleave16(row6, row7);
+					}
+
+					// row pass
+					dct_pass(bias_1, 17);
+
+					{
+						// pack and 8bit 8x8 transpose
+						__m128i p0 = _mm_packus_epi16(row0, row1);
+						__m128i p1 = _mm_packus_epi16(row2, row3);
+						__m128i p2 = _mm_packus_epi16(row4, row5);
+						__m128i p3 = _mm_packus_epi16(row6, row7);
+
+						dct_interleave8(p0, p2);
+						dct_interleave8(p1, p3);
+
+						dct_interleave8(p0, p1);
+						dct_interleave8(p2, p3);
+
+						dct_interleave8(p0, p2);
+						dct_interleave8(p1, p3);
+
+						// store
+						_mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+						_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+						_mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+						_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+						_mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+						_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+						_mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+						_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+					}
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+				}
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 				// NEON integer IDCT. should produce bit-identical
@@ -2645,8 +3020,7 @@ namespace zz
 
 					// butterfly a/b, then shift using "shiftop" by "s" and pack
 #define dct_bfly32o(out0,out1, a,b,shiftop,s) \
-					{
-					\
+					{ \
 						dct_wadd(sum, a, b); \
 						dct_wsub(dif, a, b); \
 						out0 = vcombine_s16(shiftop(sum_l, s), shiftop(sum_h, s)); \
@@ -2843,91 +3217,248 @@ namespace zz
 					// since we don't even allow 1<<30 pixels
 				}
 
+				// number of MCUs in a baseline scan, non-interleaved scans code one block per MCU
+				int stbi__jpeg_baseline_mcus(stbi__jpeg *z)
+				{
+					if (z->scan_n == 1) {
+						int n = z->order[0];
+						int w = (z->img_comp[n].x + z->block_size - 1) / z->block_size;
+						int h = (z->img_comp[n].y + z->block_size - 1) / z->block_size;
+						return w * h;
+					}
+					return z->img_mcu_x * z->img_mcu_y;
+				}
+
+				// decode and idct one baseline MCU given its index in scan order
+				int stbi__jpeg_decode_baseline_mcu(stbi__jpeg *z, int mcu, short data[64])
+				{
+					int bs = z->block_size;
+					if (z->scan_n == 1) {
+						// non-interleaved data, we just need to process one block at a time,
+						// in trivial scanline order
+						// number of blocks to do just depends on how many actual "pixels" this
+						// component has, independent of interleaved MCU blocking and such
+						int n = z->order[0];
+						int w = (z->img_comp[n].x + bs - 1) / bs;
+						int i = mcu % w, j = mcu / w;
+						// block rows wrap around the plane ring, v of them per MCU row
+						int y2 = (j % (z->plane_mcu_rows * z->img_comp[n].v)) * bs;
+						int ha = z->img_comp[n].ha;
+						if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+						z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + i * bs, z->img_comp[n].w2, data);
+					}
+					else { // interleaved
+						int i = mcu % z->img_mcu_x, j = mcu / z->img_mcu_x;
+						int k, x, y;
+						// scan an interleaved mcu... process scan_n components in order
+						for (k = 0; k < z->scan_n; ++k) {
+							int n = z->order[k];
+							// scan out an mcu's worth of this component; that's just determined
+							// by the basic H and V specified for the component
+							for (y = 0; y < z->img_comp[n].v; ++y) {
+								for (x = 0; x < z->img_comp[n].h; ++x) {
+									int x2 = (i*z->img_comp[n].h + x) * bs;
+									int y2 = ((j % z->plane_mcu_rows) * z->img_comp[n].v + y) * bs;
+									int ha = z->img_comp[n].ha;
+									if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+									z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
+								}
+							}
+						}
+					}
+					return 1;
+				}
+
+				// decode restart segments [first, last) with a private copy of the decoder
+				// state; segments only share the component planes, each writes its own blocks.
+				// returns the failure reason, NULL on success, the caller reports it
+				const char *stbi__jpeg_decode_segments(stbi__jpeg *z, stbi_uc **seg, int first, int last, int total)
+				{
+					STBI_SIMD_ALIGN(short, data[64]);
+					stbi__context s = *z->s;
+					stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+					const char *reason = NULL;
+					int k;
+					if (!j) return "outofmem";
+					memcpy(j, z, sizeof(stbi__jpeg));
+					j->s = &s;
+					for (k = first; k < last && !reason; ++k) {
+						int mcu = k * z->restart_interval;
+						int end = mcu + z->restart_interval < total ? mcu + z->restart_interval : total;
+						// bounding the buffer makes the bit reader zero-fill at the segment end
+						s.img_buffer = seg[2 * k];
+						s.img_buffer_end = seg[2 * k + 1];
+						stbi__jpeg_reset(j);
+						for (; mcu < end; ++mcu) {
+							if (!stbi__jpeg_decode_baseline_mcu(j, mcu, data)) {
+								reason = "bad restart segment";
+								break;
+							}
+						}
+					}
+					STBI_FREE(j);
+					return reason;
+				}
+
+				// a scan is split into restart segments when decode threads are set, it has
+				// restart markers and it is completely in memory
+				int stbi__jpeg_scan_splits(stbi__jpeg *z, int total)
+				{
+					int ri = z->restart_interval;
+					if (stbi__jpeg_decode_threads.load() < 2 || ri <= 0 || z->s->read_from_callbacks) return 0;
+					return (total + ri - 1) / ri >= 2 && total >= 64;
+				}
+
+				// returns -1 if the scan can't be split and must be decoded serially
+				int stbi__parse_baseline_parallel(stbi__jpeg *z, int total)
+				{
+					int ri = z->restart_interval;
+					int threads = stbi__jpeg_decode_threads.load();
+					int nseg, nthreads, k, t;
+					stbi_uc *p, *end, **seg;
+					const char *result[64];
+
+					if (z->stream || !stbi__jpeg_scan_splits(z, total)) return -1;
+					nseg = (total + ri - 1) / ri;
+					nthreads = threads < nseg ? threads : nseg;
+					if (nthreads > 64) nthreads = 64;
+
+					// find the restart markers, the scan is complete in memory
+					seg = (stbi_uc **)stbi__malloc(2 * nseg * sizeof(stbi_uc *));
+					if (!seg) return -1;
+					p = z->s->img_buffer;
+					end = z->s->img_buffer_end;
+					seg[0] = p;
+					k = 0;
+					while (p + 1 < end) {
+						stbi_uc b;
+						p = (stbi_uc *)memchr(p, 0xff, end - p - 1);
+						if (!p) { p = end; break; }
+						b = p[1];
+						if (b == 0x00) { p += 2; continue; }   // stuffed zero
+						if (b == 0xff) { ++p; continue; }      // fill byte
+						if (b < 0xd0 || b > 0xd7) break;       // end of scan
+						seg[2 * k + 1] = p;
+						if (++k >= nseg) break;                // more markers than expected
+						p += 2;
+						seg[2 * k] = p;
+					}
+					if (k != nseg - 1) { STBI_FREE(seg); return -1; }
+					seg[2 * k + 1] = p;
+
+					{
+						std::vector<std::thread> workers;
+						for (t = 1; t < nthreads; ++t) {
+							workers.push_back(std::thread([=, &result]() {
+								result[t] = stbi__jpeg_decode_segments(z, seg,
+									nseg * t / nthreads, nseg * (t + 1) / nthreads, total);
+							}));
+						}
+						result[0] = stbi__jpeg_decode_segments(z, seg, 0, nseg / nthreads, total);
+						for (t = 0; t < (int)workers.size(); ++t) workers[t].join();
+					}
+					STBI_FREE(seg);
+
+					// leave the stream at the marker ending the scan
+					z->s->img_buffer = p;
+					z->code_bits = 0;
+					z->marker = STBI__MARKER_none;
+					// first failing segment in image order wins
+					for (t = 0; t < nthreads; ++t) {
+						if (result[t]) return stbi__err(result[t], result[t]);
+					}
+					return 1;
+				}
+
+				// allocate component planes for mcu_rows rows of MCUs; fewer rows than
+				// img_mcu_y make a ring, plane row r then lives at row r % h2
+				int stbi__jpeg_alloc_planes(stbi__jpeg *z, int mcu_rows)
+				{
+					int i;
+					z->plane_mcu_rows = mcu_rows;
+					for (i = 0; i < z->s->img_n; ++i) {
+						// to simplify generation, we'll allocate enough memory to decode
+						// the bogus oversized data from using interleaved MCUs and their
+						// big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
+						// discard the extra data until colorspace conversion
+						STBI_FREE(z->img_comp[i].raw_data);
+						z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * z->block_size;
+						z->img_comp[i].h2 = mcu_rows * z->img_comp[i].v * z->block_size;
+						z->img_comp[i].raw_data = stbi__malloc(z->img_comp[i].w2 * z->img_comp[i].h2 + 15);
+						z->img_comp[i].data = NULL;
+						if (z->img_comp[i].raw_data == NULL)
+							return stbi__err("outofmem", "Out of memory");
+						// align blocks for idct using mmx/sse
+						z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+					}
+					return 1;
+				}
+
+				int stbi__jpeg_emit_rows(stbi__jpeg *z, int mcu_rows);
+
 				int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 				{
 					stbi__jpeg_reset(z);
 					if (!z->progressive) {
+						STBI_SIMD_ALIGN(short, data[64]);
+						int mcu, total, r;
+						// MCUs of one row of blocks in scan order and such rows per MCU row;
+						// a single component scan counts blocks, not interleaved MCUs
+						int row_mcus = z->img_mcu_x, row_blocks = 1;
+						total = stbi__jpeg_baseline_mcus(z);
+						// components coming in separate scans need planes holding the whole
+						// image, and so do restart segments decoded in parallel; rows then go
+						// to the callback once the image is complete
+						if (z->stream && (z->scan_n != z->s->img_n || (!z->output && stbi__jpeg_scan_splits(z, total)))) {
+							if (z->output) return stbi__err("bad scan layout", "Corrupt JPEG");
+							if (!stbi__jpeg_alloc_planes(z, z->img_mcu_y)) return 0;
+							z->stream = 0;
+						}
+						if (z->scan_n == 1) {
+							int n = z->order[0];
+							row_mcus = (z->img_comp[n].x + z->block_size - 1) / z->block_size;
+							row_blocks = z->img_comp[n].v;
+						}
+						r = stbi__parse_baseline_parallel(z, total);
+						if (r >= 0) return r;
+						for (mcu = 0; mcu < total; ++mcu) {
+							if (!stbi__jpeg_decode_baseline_mcu(z, mcu, data)) return 0;
+							// convert the rows a finished MCU row completes before it gets overwritten
+							if (z->stream && (mcu + 1) % row_mcus == 0)
+								if (!stbi__jpeg_emit_rows(z, (mcu + 1) / row_mcus / row_blocks)) return 0;
+							// every MCU counts down the restart interval
+							if (--z->todo <= 0) {
+								if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+								// if it's NOT a restart, then just bail, so we get corrupt data
+								// rather than no data
+								if (!STBI__RESTART(z->marker)) return 1;
+								stbi__jpeg_reset(z);
+							}
+						}
+						return 1;
+					}
+					else {
 						if (z->scan_n == 1) {
 							int i, j;
-							STBI_SIMD_ALIGN(short, data[64]);
 							int n = z->order[0];
 							// non-interleaved data, we just need to process one block at a time,
 							// in trivial scanline order
 							// number of blocks to do just depends on how many actual "pixels" this
 							// component has, independent of interleaved MCU blocking and such
-							int w = (z->img_comp[n].x + 7) >> 3;
-							int h = (z->img_comp[n].y + 7) >> 3;
+							int w = (z->img_comp[n].x + z->block_size - 1) / z->block_size;
+							int h = (z->img_comp[n].y + z->block_size - 1) / z->block_size;
 							for (j = 0; j < h; ++j) {
 								for (i = 0; i < w; ++i) {
-									int ha = z->img_comp[n].ha;
-									if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-									z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
-									// every data block is an MCU, so countdown the restart interval
-									if (--z->todo <= 0) {
-										if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-										// if it's NOT a restart, then just bail, so we get corrupt data
-										// rather than no data
-										if (!STBI__RESTART(z->marker)) return 1;
-										stbi__jpeg_reset(z);
-									}
-								}
-							}
-							return 1;
-						}
-						else { // interleaved
-							int i, j, k, x, y;
-							STBI_SIMD_ALIGN(short, data[64]);
-							for (j = 0; j < z->img_mcu_y; ++j) {
-								for (i = 0; i < z->img_mcu_x; ++i) {
-									// scan an interleaved mcu... process scan_n components in order
-									for (k = 0; k < z->scan_n; ++k) {
-										int n = z->order[k];
-										// scan out an mcu's worth of this component; that's just determined
-										// by the basic H and V specified for the component
-										for (y = 0; y < z->img_comp[n].v; ++y) {
-											for (x = 0; x < z->img_comp[n].h; ++x) {
-												int x2 = (i*z->img_comp[n].h + x) * 8;
-												int y2 = (j*z->img_comp[n].v + y) * 8;
-												int ha = z->img_comp[n].ha;
-												if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-												z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
-											}
-										}
-									}
-									// after all interleaved components, that's an interleaved MCU,
-									// so now count down the restart interval
-									if (--z->todo <= 0) {
-										if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-										if (!STBI__RESTART(z->marker)) return 1;
-										stbi__jpeg_reset(z);
-									}
-								}
-							}
-							return 1;
-						}
-					}
-					else {
-						if (z->scan_n == 1) {
-							int i, j;
-							int n = z->order[0];
-							// non-interleaved data, we just need to process one block at a time,
-							// in trivial scanline order
-							// number of blocks to do just depends on how many actual "pixels" this
-							// component has, independent of interleaved MCU blocking and such
-							int w = (z->img_comp[n].x + 7) >> 3;
-							int h = (z->img_comp[n].y + 7) >> 3;
-							for (j = 0; j < h; ++j) {
-								for (i = 0; i < w; ++i) {
-									short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-									if (z->spec_start == 0) {
-										if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
-											return 0;
-									}
-									else {
-										int ha = z->img_comp[n].ha;
-										if (!stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha], z->fast_ac[ha]))
-											return 0;
-									}
+									short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+									if (z->spec_start == 0) {
+										if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
+											return 0;
+									}
+									else {
+										int ha = z->img_comp[n].ha;
+										if (!stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha], z->fast_ac[ha]))
+											return 0;
+									}
 									// every data block is an MCU, so countdown the restart interval
 									if (--z->todo <= 0) {
 										if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2984,13 +3515,13 @@ namespace zz
 						// dequantize and idct the data
 						int i, j, n;
 						for (n = 0; n < z->s->img_n; ++n) {
-							int w = (z->img_comp[n].x + 7) >> 3;
-							int h = (z->img_comp[n].y + 7) >> 3;
+							int w = (z->img_comp[n].x + z->block_size - 1) / z->block_size;
+							int h = (z->img_comp[n].y + z->block_size - 1) / z->block_size;
 							for (j = 0; j < h; ++j) {
 								for (i = 0; i < w; ++i) {
 									short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
 									stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-									z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
+									z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * z->block_size + i * z->block_size, z->img_comp[n].w2, data);
 								}
 							}
 						}
@@ -3148,31 +3679,30 @@ namespace zz
 					z->img_mcu_x = (s->img_x + z->img_mcu_w - 1) / z->img_mcu_w;
 					z->img_mcu_y = (s->img_y + z->img_mcu_h - 1) / z->img_mcu_h;
 
+					// pick the strongest dct domain downscale that still covers the requested size
+					z->scale_shift = 0;
+					if (s->jpeg_min_x > 0 || s->jpeg_min_y > 0) {
+						while (z->scale_shift < 3) {
+							int d = 1 << (z->scale_shift + 1);
+							if ((int)((s->img_x + d - 1) / d) < s->jpeg_min_x) break;
+							if ((int)((s->img_y + d - 1) / d) < s->jpeg_min_y) break;
+							++z->scale_shift;
+						}
+					}
+					z->block_size = 8 >> z->scale_shift;
+					if (z->scale_shift == 1) z->idct_block_kernel = stbi__idct_block_4x4;
+					else if (z->scale_shift == 2) z->idct_block_kernel = stbi__idct_block_2x2;
+					else if (z->scale_shift == 3) z->idct_block_kernel = stbi__idct_block_1x1;
+
 					for (i = 0; i < s->img_n; ++i) {
 						// number of effective pixels (e.g. for non-interleaved MCU)
-						z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max - 1) / h_max;
-						z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max - 1) / v_max;
-						// to simplify generation, we'll allocate enough memory to decode
-						// the bogus oversized data from using interleaved MCUs and their
-						// big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
-						// discard the extra data until colorspace conversion
-						z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-						z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-						z->img_comp[i].raw_data = stbi__malloc(z->img_comp[i].w2 * z->img_comp[i].h2 + 15);
-
-						if (z->img_comp[i].raw_data == NULL) {
-							for (--i; i >= 0; --i) {
-								STBI_FREE(z->img_comp[i].raw_data);
-								z->img_comp[i].raw_data = NULL;
-							}
-							return stbi__err("outofmem", "Out of memory");
-						}
-						// align blocks for idct using mmx/sse
-						z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+						int d = 1 << z->scale_shift;
+						z->img_comp[i].x = ((s->img_x * z->img_comp[i].h + h_max - 1) / h_max + d - 1) >> z->scale_shift;
+						z->img_comp[i].y = ((s->img_y * z->img_comp[i].v + v_max - 1) / v_max + d - 1) >> z->scale_shift;
 						z->img_comp[i].linebuf = NULL;
 						if (z->progressive) {
-							z->img_comp[i].coeff_w = (z->img_comp[i].w2 + 7) >> 3;
-							z->img_comp[i].coeff_h = (z->img_comp[i].h2 + 7) >> 3;
+							z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+							z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
 							z->img_comp[i].raw_coeff = STBI_MALLOC(z->img_comp[i].coeff_w * z->img_comp[i].coeff_h * 64 * sizeof(short)+15);
 							z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
 						}
@@ -3182,6 +3712,16 @@ namespace zz
 						}
 					}
 
+					// baseline scans can be converted to rows as they decode, so with a row
+					// callback the planes only keep a ring of 3 MCU rows: the current one and
+					// the neighbours fancy upsampling looks at
+					if (!stbi__jpeg_alloc_planes(z, s->row_cb && !z->progressive && z->img_mcu_y > 3 ? 3 : z->img_mcu_y))
+						return 0;
+					z->stream = z->plane_mcu_rows < z->img_mcu_y;
+
+					// from here on the image is seen at output scale
+					s->img_x = (s->img_x + (1 << z->scale_shift) - 1) >> z->scale_shift;
+					s->img_y = (s->img_y + (1 << z->scale_shift) - 1) >> z->scale_shift;
 					return 1;
 				}
 
@@ -3225,6 +3765,9 @@ namespace zz
 						j->img_comp[m].raw_coeff = NULL;
 					}
 					j->restart_interval = 0;
+					j->stream = 0;
+					j->out_row = 0;
+					j->output = j->tail = NULL;
 					if (!stbi__decode_jpeg_header(j, STBI__SCAN_load)) return 0;
 					m = stbi__get_marker(j);
 					while (!stbi__EOI(m)) {
@@ -3258,9 +3801,6 @@ namespace zz
 
 				//  jfif-centered resampling (across block boundaries)
 
-				typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
-					int w, int hs);
-
 #define stbi__div4(x) ((stbi_uc) ((x) >> 2))
 
 				stbi_uc *resample_row_1(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
@@ -3657,9 +4197,169 @@ namespace zz
 				}
 #endif
 
+#ifdef STBI_AVX2
+				// avx2 2x2 upsampling, 16 input pixels per step, same results as sse2 version
+				STBI_AVX2_TARGET
+				stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+				{
+					int i = 0, t0, t1;
+
+					if (w == 1) {
+						out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+						return out;
+					}
+
+					t1 = 3 * in_near[0] + in_far[0];
+					for (; i < ((w - 1) & ~15); i += 16) {
+						// vertical pass, 3*x + y = 4*x + (y - x)
+						__m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+						__m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+						__m256i diff = _mm256_sub_epi16(farw, nearw);
+						__m256i nears = _mm256_slli_epi16(nearw, 2);
+						__m256i curr = _mm256_add_epi16(nears, diff);
+
+						// shift current row by one pixel across the lane boundary
+						__m256i lo = _mm256_permute2x128_si256(curr, curr, 0x08); // [0, curr.lo]
+						__m256i hi = _mm256_permute2x128_si256(curr, curr, 0x81); // [curr.hi, 0]
+						__m256i prev = _mm256_insert_epi16(_mm256_alignr_epi8(curr, lo, 14), t1, 0);
+						__m256i next = _mm256_insert_epi16(_mm256_alignr_epi8(hi, curr, 2), 3 * in_near[i + 16] + in_far[i + 16], 15);
+
+						// horizontal pass, even = cur*4 + (prev - cur), odd = cur*4 + (next - cur)
+						__m256i bias = _mm256_set1_epi16(8);
+						__m256i curs = _mm256_slli_epi16(curr, 2);
+						__m256i prvd = _mm256_sub_epi16(prev, curr);
+						__m256i nxtd = _mm256_sub_epi16(next, curr);
+						__m256i curb = _mm256_add_epi16(curs, bias);
+						__m256i even = _mm256_add_epi16(prvd, curb);
+						__m256i odd = _mm256_add_epi16(nxtd, curb);
+
+						// interleave and undo scaling, in-lane unpack + pack keeps pixel order
+						__m256i de0 = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+						__m256i de1 = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+						_mm256_storeu_si256((__m256i *) (out + i * 2), _mm256_packus_epi16(de0, de1));
+
+						t1 = 3 * in_near[i + 15] + in_far[i + 15];
+					}
+
+					t0 = t1;
+					t1 = 3 * in_near[i] + in_far[i];
+					out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+					for (++i; i < w; ++i) {
+						t0 = t1;
+						t1 = 3 * in_near[i] + in_far[i];
+						out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+						out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+					}
+					out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+					STBI_NOTUSED(hs);
+
+					return out;
+				}
+
+#ifndef STBI_JPEG_OLD
+				// avx2 color conversion, 16 pixels per step, same math as the sse2 version.
+				// Unlike sse2 this also handles the common step == 3 case.
+				STBI_AVX2_TARGET
+				void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+				{
+					int i = 0;
+					if (step == 3 || step == 4) {
+						__m256i signflip = _mm256_set1_epi16(0x80);
+						__m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f*4096.0f + 0.5f));
+						__m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f*4096.0f + 0.5f));
+						__m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f*4096.0f + 0.5f));
+						__m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f*4096.0f + 0.5f));
+						__m256i y_bias = _mm256_set1_epi16(128);
+						__m256i xw = _mm256_set1_epi16(255); // alpha channel
+						// drops alpha of the 4 rgba pixels in each lane
+						__m256i rgb_shuf = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+							0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+						// rgb stores write 4 bytes past the 16 pixels, keep them inside the row
+						int limit = step == 4 ? count - 15 : count - 17;
+
+						for (; i < limit; i += 16) {
+							__m256i y_bytes = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y + i)));
+							__m256i cr_bytes = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcr + i)));
+							__m256i cb_bytes = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcb + i)));
+
+							// same fixed point layout as sse2: (y << 8) + 128, (c - 128) << 8
+							__m256i yw = _mm256_or_si256(_mm256_slli_epi16(y_bytes, 8), y_bias);
+							__m256i crw = _mm256_slli_epi16(_mm256_xor_si256(cr_bytes, signflip), 8);
+							__m256i cbw = _mm256_slli_epi16(_mm256_xor_si256(cb_bytes, signflip), 8);
+
+							// color transform
+							__m256i yws = _mm256_srli_epi16(yw, 4);
+							__m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+							__m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+							__m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+							__m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+							__m256i rws = _mm256_add_epi16(cr0, yws);
+							__m256i gwt = _mm256_add_epi16(cb0, yws);
+							__m256i bws = _mm256_add_epi16(yws, cb1);
+							__m256i gws = _mm256_add_epi16(gwt, cr1);
+
+							// descale
+							__m256i rw = _mm256_srai_epi16(rws, 4);
+							__m256i bw = _mm256_srai_epi16(bws, 4);
+							__m256i gw = _mm256_srai_epi16(gws, 4);
+
+							// interleave in each lane: o0 = pixels 0-3 | 8-11, o1 = 4-7 | 12-15
+							__m256i brb = _mm256_packus_epi16(rw, bw);
+							__m256i gxb = _mm256_packus_epi16(gw, xw);
+							__m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+							__m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+							__m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+							__m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+							if (step == 4) {
+								_mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+								_mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+								out += 64;
+							}
+							else {
+								__m256i c0 = _mm256_shuffle_epi8(o0, rgb_shuf);
+								__m256i c1 = _mm256_shuffle_epi8(o1, rgb_shuf);
+								// ascending overlapped stores, junk tail of each is overwritten by the next
+								_mm_storeu_si128((__m128i *) (out + 0), _mm256_castsi256_si128(c0));
+								_mm_storeu_si128((__m128i *) (out + 12), _mm256_castsi256_si128(c1));
+								_mm_storeu_si128((__m128i *) (out + 24), _mm256_extracti128_si256(c0, 1));
+								_mm_storeu_si128((__m128i *) (out + 36), _mm256_extracti128_si256(c1, 1));
+								out += 48;
+							}
+						}
+					}
+
+					for (; i < count; ++i) {
+						int y_fixed = (y[i] << 20) + (1 << 19); // rounding
+						int r, g, b;
+						int cr = pcr[i] - 128;
+						int cb = pcb[i] - 128;
+						r = y_fixed + cr* float2fixed(1.40200f);
+						g = y_fixed + cr*-float2fixed(0.71414f) + ((cb*-float2fixed(0.34414f)) & 0xffff0000);
+						b = y_fixed + cb* float2fixed(1.77200f);
+						r >>= 20;
+						g >>= 20;
+						b >>= 20;
+						if ((unsigned)r > 255) { if (r < 0) r = 0; else r = 255; }
+						if ((unsigned)g > 255) { if (g < 0) g = 0; else g = 255; }
+						if ((unsigned)b > 255) { if (b < 0) b = 0; else b = 255; }
+						out[0] = (stbi_uc)r;
+						out[1] = (stbi_uc)g;
+						out[2] = (stbi_uc)b;
+						out[3] = 255;
+						out += step;
+					}
+				}
+#endif
+#endif // STBI_AVX2
+
 				// set up the kernels
 				void stbi__setup_jpeg(stbi__jpeg *j)
 				{
+					j->scale_shift = 0;
+					j->block_size = 8;
 					j->idct_block_kernel = stbi__idct_block;
 					j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
 					j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3674,6 +4374,16 @@ namespace zz
 					}
 #endif
 
+#ifdef STBI_AVX2
+					if (stbi__avx2_available()) {
+						j->idct_block_kernel = stbi__idct_avx2;
+#ifndef STBI_JPEG_OLD
+						j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+#endif
+						j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+					}
+#endif
+
 #ifdef STBI_NEON
 					j->idct_block_kernel = stbi__idct_simd;
 #ifndef STBI_JPEG_OLD
@@ -3705,113 +4415,148 @@ namespace zz
 					}
 				}
 
-				typedef struct
-				{
-					resample_row_func resample;
-					stbi_uc *line0, *line1;
-					int hs, vs;   // expansion factor in each axis
-					int w_lores; // horizontal pixels pre-expansion
-					int ystep;   // how far through vertical expansion we are
-					int ypos;    // which pre-expansion row we're on
-				} stbi__resample;
-
-				stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+				// set up resamplers and the output buffer once the component layout is known
+				int stbi__jpeg_begin_output(stbi__jpeg *z)
 				{
-					int n, decode_n;
-					z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-					// validate req_comp
-					if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-					// load a jpeg image from whichever source, but leave in YCbCr format
-					if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+					int k, n;
 
 					// determine actual number of components to generate
-					n = req_comp ? req_comp : z->s->img_n;
+					n = z->out_n = z->req_comp ? z->req_comp : z->s->img_n;
 
 					if (z->s->img_n == 3 && n < 3)
-						decode_n = 1;
+						z->decode_n = 1;
+					else
+						z->decode_n = z->s->img_n;
+
+					for (k = 0; k < z->decode_n; ++k) {
+						stbi__resample *r = &z->res_comp[k];
+
+						// allocate line buffer big enough for upsampling off the edges
+						// with upsample factor of 4
+						z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
+						if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+						r->hs = z->img_h_max / z->img_comp[k].h;
+						r->vs = z->img_v_max / z->img_comp[k].v;
+						r->ystep = r->vs >> 1;
+						r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
+						r->ypos = 0;
+						r->line0 = r->line1 = z->img_comp[k].data;
+
+						if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+						else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+						else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+						else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+						else                               r->resample = stbi__resample_row_generic;
+					}
+
+					if (z->s->row_cb) {
+						// rows are handed out one at a time, one line is all the output needed
+						z->output = (stbi_uc *)stbi__malloc(n * z->s->img_x + 1);
+						z->s->rows_sent = 1;
+					}
+					else if (z->s->out_alloc) {
+						// converters may write one byte past a row, so the last row of
+						// an exactly sized external buffer goes through a scratch line
+						z->tail = (stbi_uc *)stbi__malloc(n * z->s->img_x + 1);
+						if (!z->tail) return stbi__err("outofmem", "Out of memory");
+						z->output = z->s->out_alloc(z->s->out_alloc_user, z->s->img_x, z->s->img_y, n);
+						if (!z->output) { STBI_FREE(z->tail); z->tail = NULL; }
+					}
 					else
-						decode_n = z->s->img_n;
+						z->output = (stbi_uc *)stbi__malloc(n * z->s->img_x * z->s->img_y + 1);
+					if (!z->output) return stbi__err("outofmem", "Out of memory");
+					return 1;
+				}
 
-					// resample and color-convert
-					{
-						int k;
-						unsigned int i, j;
-						stbi_uc *output;
-						stbi_uc *coutput[4];
-
-						stbi__resample res_comp[4];
-
-						for (k = 0; k < decode_n; ++k) {
-							stbi__resample *r = &res_comp[k];
-
-							// allocate line buffer big enough for upsampling off the edges
-							// with upsample factor of 4
-							z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
-							if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-							r->hs = z->img_h_max / z->img_comp[k].h;
-							r->vs = z->img_v_max / z->img_comp[k].v;
-							r->ystep = r->vs >> 1;
-							r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
-							r->ypos = 0;
-							r->line0 = r->line1 = z->img_comp[k].data;
-
-							if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-							else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-							else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-							else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-							else                               r->resample = stbi__resample_row_generic;
-						}
-
-						// can't error after this so, this is safe
-						output = (stbi_uc *)stbi__malloc(n * z->s->img_x * z->s->img_y + 1);
-						if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-						// now go ahead and resample
-						for (j = 0; j < z->s->img_y; ++j) {
-							stbi_uc *out = output + n * z->s->img_x * j;
-							for (k = 0; k < decode_n; ++k) {
-								stbi__resample *r = &res_comp[k];
-								int y_bot = r->ystep >= (r->vs >> 1);
-								coutput[k] = r->resample(z->img_comp[k].linebuf,
-									y_bot ? r->line1 : r->line0,
-									y_bot ? r->line0 : r->line1,
-									r->w_lores, r->hs);
-								if (++r->ystep >= r->vs) {
-									r->ystep = 0;
-									r->line0 = r->line1;
-									if (++r->ypos < z->img_comp[k].y)
-										r->line1 += z->img_comp[k].w2;
-								}
+				// resample and color-convert every pending row whose source lines are
+				// within the first mcu_rows MCU rows decoded so far
+				int stbi__jpeg_emit_rows(stbi__jpeg *z, int mcu_rows)
+				{
+					int k, n;
+					unsigned int i, j;
+					stbi_uc *coutput[4];
+
+					if (!z->output && !stbi__jpeg_begin_output(z)) return 0;
+					n = z->out_n;
+
+					for (; z->out_row < z->s->img_y; ++z->out_row) {
+						stbi_uc *out;
+						j = z->out_row;
+						for (k = 0; k < z->decode_n; ++k) {
+							// pre-expansion rows this output row reads, see the stepping below
+							int vs = z->res_comp[k].vs;
+							int need = (int)(j + (vs >> 1)) / vs;
+							if (need > z->img_comp[k].y - 1) need = z->img_comp[k].y - 1;
+							if (need >= mcu_rows * z->img_comp[k].v * z->block_size) return 1;
+						}
+
+						if (z->s->row_cb) out = z->output;
+						else out = (z->tail && j + 1 == z->s->img_y) ? z->tail : z->output + n * z->s->img_x * j;
+						for (k = 0; k < z->decode_n; ++k) {
+							stbi__resample *r = &z->res_comp[k];
+							int y_bot = r->ystep >= (r->vs >> 1);
+							coutput[k] = r->resample(z->img_comp[k].linebuf,
+								y_bot ? r->line1 : r->line0,
+								y_bot ? r->line0 : r->line1,
+								r->w_lores, r->hs);
+							if (++r->ystep >= r->vs) {
+								r->ystep = 0;
+								r->line0 = r->line1;
+								if (++r->ypos < z->img_comp[k].y)
+									r->line1 = z->img_comp[k].data + z->img_comp[k].w2 * (r->ypos % z->img_comp[k].h2);
 							}
-							if (n >= 3) {
-								stbi_uc *y = coutput[0];
-								if (z->s->img_n == 3) {
-									z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-								}
-								else
-								for (i = 0; i < z->s->img_x; ++i) {
-									out[0] = out[1] = out[2] = y[i];
-									out[3] = 255; // not used if n==3
-									out += n;
-								}
+						}
+						if (n >= 3) {
+							stbi_uc *y = coutput[0];
+							if (z->s->img_n == 3) {
+								z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
 							}
-							else {
-								stbi_uc *y = coutput[0];
-								if (n == 1)
-								for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-								else
-								for (i = 0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+							else
+							for (i = 0; i < z->s->img_x; ++i) {
+								out[0] = out[1] = out[2] = y[i];
+								out[3] = 255; // not used if n==3
+								out += n;
 							}
 						}
+						else {
+							stbi_uc *y = coutput[0];
+							if (n == 1)
+							for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+							else
+							for (i = 0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+						}
+						if (z->s->row_cb)
+							z->s->row_cb(z->s->row_user, j, z->s->img_x, z->s->img_y, n, z->output);
+					}
+					return 1;
+				}
+
+				stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+				{
+					z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+					// validate req_comp
+					if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+					z->req_comp = req_comp;
+
+					// load a jpeg image from whichever source, but leave in YCbCr format;
+					// when streaming, rows are already converted as the scan comes in
+					if (!stbi__decode_jpeg_image(z) || !stbi__jpeg_emit_rows(z, z->img_mcu_y)) {
+						if (z->s->row_cb) STBI_FREE(z->output);
 						stbi__cleanup_jpeg(z);
-						*out_x = z->s->img_x;
-						*out_y = z->s->img_y;
-						if (comp) *comp = z->s->img_n; // report original components, not output
-						return output;
+						return NULL;
+					}
+
+					if (z->tail) {
+						memcpy(z->output + z->out_n * z->s->img_x * (z->s->img_y - 1), z->tail, z->out_n * z->s->img_x);
+						STBI_FREE(z->tail);
 					}
+					stbi__cleanup_jpeg(z);
+					*out_x = z->s->img_x;
+					*out_y = z->s->img_y;
+					if (comp) *comp = z->s->img_n; // report original components, not output
+					return z->output;
 				}
 
 				unsigned char *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp)
@@ -7844,6 +8589,14 @@ namespace zz
 					float s0, float t0, float s1, float t1);
 				// (s0, t0) & (s1, t1) are the top-left and bottom right corner (uv addressing style: [0, 1]x[0, 1]) of a region of the input image to use.
 
+				// Produce only output rows [first_row, last_row) of an output_w x output_h resize, with the
+				// same default filters and edge modes as stbir_resize_uint8/float. output_pixels points to
+				// first_row. Filters are computed for the whole image, so separately resized bands join
+				// into exactly the result of one full resize.
+				int stbir_resize_rows(const void *input_pixels, int input_w, int input_h, int input_stride_in_bytes,
+					void *output_pixels, int output_w, int output_h, int output_stride_in_bytes,
+					stbir_datatype datatype, int num_channels, int first_row, int last_row);
+
 #ifndef STBIR_ASSERT
 //#include <assert.h>
 #define STBIR_ASSERT(x) assert(x)
@@ -7966,6 +8719,7 @@ namespace zz
 					int output_w;
 					int output_h;
 					int output_stride_bytes;
+					int output_y0, output_y1; // band of output rows written, output_data points to row output_y0
 
 					float s0, t0, s1, t1;
 
@@ -9357,7 +10111,7 @@ namespace zz
 					n0 = vertical_contributors[contributor].n0;
 					n1 = vertical_contributors[contributor].n1;
 
-					output_row_start = n * stbir_info->output_stride_bytes;
+					output_row_start = (n - stbir_info->output_y0) * stbir_info->output_stride_bytes;
 
 					STBIR__DEBUG_ASSERT(stbir__use_height_upsampling(stbir_info));
 
@@ -9536,7 +10290,7 @@ namespace zz
 
 					STBIR__DEBUG_ASSERT(stbir__use_height_upsampling(stbir_info));
 
-					for (y = 0; y < stbir_info->output_h; y++)
+					for (y = stbir_info->output_y0; y < stbir_info->output_y1; y++)
 					{
 						float in_center_of_out = 0; // Center of the current out scanline in the in scanline space
 						int in_first_scanline = 0, in_last_scanline = 0;
@@ -9600,9 +10354,9 @@ namespace zz
 						// Get rid of whatever we don't need anymore.
 						while (first_necessary_scanline > stbir_info->ring_buffer_first_scanline)
 						{
-							if (stbir_info->ring_buffer_first_scanline >= 0 && stbir_info->ring_buffer_first_scanline < stbir_info->output_h)
+							if (stbir_info->ring_buffer_first_scanline >= stbir_info->output_y0 && stbir_info->ring_buffer_first_scanline < stbir_info->output_y1)
 							{
-								int output_row_start = stbir_info->ring_buffer_first_scanline * output_stride_bytes;
+								int output_row_start = (stbir_info->ring_buffer_first_scanline - stbir_info->output_y0) * output_stride_bytes;
 								float* ring_buffer_entry = stbir__get_ring_buffer_entry(ring_buffer, stbir_info->ring_buffer_begin_index, ring_buffer_length);
 								stbir__encode_scanline(stbir_info, output_w, (char *)output_data + output_row_start, ring_buffer_entry, channels, alpha_channel, decode);
 								STBIR_PROGRESS_REPORT((float)stbir_info->ring_buffer_first_scanline / stbir_info->output_h);
@@ -9630,7 +10384,8 @@ namespace zz
 				{
 					int y;
 					float scale_ratio = stbir_info->vertical_scale;
-					int output_h = stbir_info->output_h;
+					int output_y0 = stbir_info->output_y0;
+					int output_y1 = stbir_info->output_y1;
 					float in_pixels_radius = stbir__filter_info_table[stbir_info->vertical_filter].support(scale_ratio) / scale_ratio;
 					int pixel_margin = stbir_info->vertical_filter_pixel_margin;
 					int max_y = stbir_info->input_h + pixel_margin;
@@ -9646,7 +10401,8 @@ namespace zz
 
 						STBIR__DEBUG_ASSERT(out_last_scanline - out_first_scanline <= stbir_info->vertical_filter_pixel_width);
 
-						if (out_last_scanline < 0 || out_first_scanline >= output_h)
+						// input rows outside the band are skipped, the rows inside see the same accumulation order
+						if (out_last_scanline < output_y0 || out_first_scanline >= output_y1)
 							continue;
 
 						stbir__empty_ring_buffer(stbir_info, out_first_scanline);
@@ -9673,6 +10429,8 @@ namespace zz
 					info->input_h = input_h;
 					info->output_w = output_w;
 					info->output_h = output_h;
+					info->output_y0 = 0;
+					info->output_y1 = output_h;
 					info->channels = channels;
 				}
 
@@ -9767,7 +10525,7 @@ namespace zz
 					unsigned char overwrite_output_after_pre[OVERWRITE_ARRAY_SIZE];
 					unsigned char overwrite_tempmem_after_pre[OVERWRITE_ARRAY_SIZE];
 
-					size_t begin_forbidden = width_stride_output * (info->output_h - 1) + info->output_w * info->channels * stbir__type_size[type];
+					size_t begin_forbidden = width_stride_output * (info->output_y1 - info->output_y0 - 1) + info->output_w * info->channels * stbir__type_size[type];
 					memcpy(overwrite_output_before_pre, &((unsigned char*)output_data)[-OVERWRITE_ARRAY_SIZE], OVERWRITE_ARRAY_SIZE);
 					memcpy(overwrite_output_after_pre, &((unsigned char*)output_data)[begin_forbidden], OVERWRITE_ARRAY_SIZE);
 					memcpy(overwrite_tempmem_before_pre, &((unsigned char*)tempmem)[-OVERWRITE_ARRAY_SIZE], OVERWRITE_ARRAY_SIZE);
@@ -10048,6 +10806,40 @@ namespace zz
 						s0, t0, s1, t1, NULL, num_channels, alpha_channel, flags, datatype, filter_horizontal, filter_vertical,
 						edge_mode_horizontal, edge_mode_vertical, space);
 				}
+
+				int stbir_resize_rows(const void *input_pixels, int input_w, int input_h, int input_stride_in_bytes,
+					void *output_pixels, int output_w, int output_h, int output_stride_in_bytes,
+					stbir_datatype datatype, int num_channels, int first_row, int last_row)
+				{
+					stbir__info info;
+					int result;
+					size_t memory_required;
+					void* extra_memory;
+
+					if (first_row < 0 || last_row > output_h || first_row >= last_row)
+						return 0;
+
+					stbir__setup(&info, input_w, input_h, output_w, output_h, num_channels);
+					info.output_y0 = first_row;
+					info.output_y1 = last_row;
+					stbir__calculate_transform(&info, 0, 0, 1, 1, NULL);
+					stbir__choose_filter(&info, STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT);
+					memory_required = stbir__calculate_memory(&info);
+					extra_memory = STBIR_MALLOC(memory_required, NULL);
+
+					if (!extra_memory)
+						return 0;
+
+					result = stbir__resize_allocated(&info, input_pixels, input_stride_in_bytes,
+						output_pixels, output_stride_in_bytes,
+						-1, 0, datatype,
+						STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+						STBIR_COLORSPACE_LINEAR, extra_memory, memory_required);
+
+					STBIR_FREE(extra_memory, NULL);
+
+					return result;
+				}
 			} // namespace stbi::resize
 
 		} // namespace stbi
@@ -10056,102 +10848,356 @@ namespace zz
 		{
 			const unsigned char s_jo_ZigZag[] = { 0, 1, 5, 6, 14, 15, 27, 28, 2, 4, 7, 13, 16, 26, 29, 42, 3, 8, 12, 17, 25, 30, 41, 43, 9, 11, 18, 24, 31, 40, 44, 53, 10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60, 21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63 };
 
-			void jo_writeBits(FILE *fp, int &bitBuf, int &bitCnt, const unsigned short *bs) {
-				bitCnt += bs[1];
-				bitBuf |= bs[0] << (24 - bitCnt);
-				while (bitCnt >= 8) {
-					unsigned char c = (bitBuf >> 16) & 255;
-					putc(c, fp);
-					if (c == 255) {
-						putc(0, fp);
+			// Output of the encoder. Headers are appended as is, entropy coded bits are
+			// collected MSB first in a 64 bit register and flushed a 32 bit word at a time.
+			struct jo_writer
+			{
+				std::vector<unsigned char> &out;
+				unsigned long long bitBuf;
+				int bitCnt;
+
+				explicit jo_writer(std::vector<unsigned char> &o) : out(o), bitBuf(0), bitCnt(0) {}
+				void put(unsigned char c) { out.push_back(c); }
+				void write(const void *p, std::size_t n)
+				{
+					const unsigned char *c = (const unsigned char *)p;
+					out.insert(out.end(), c, c + n);
+				}
+			};
+
+			inline void jo_writeBits(jo_writer &w, const unsigned short *bs) {
+				w.bitBuf = (w.bitBuf << bs[1]) | bs[0];
+				w.bitCnt += bs[1];
+				if (w.bitCnt >= 32) {
+					w.bitCnt -= 32;
+					unsigned int word = (unsigned int)(w.bitBuf >> w.bitCnt);
+					unsigned char c[4] = { (unsigned char)(word >> 24), (unsigned char)(word >> 16), (unsigned char)(word >> 8), (unsigned char)word };
+					if (((~word - 0x01010101u) & word & 0x80808080u) == 0) {
+						// no 0xFF byte in the word, nothing to stuff
+						w.out.insert(w.out.end(), c, c + 4);
+					}
+					else {
+						for (int i = 0; i < 4; ++i) {
+							w.out.push_back(c[i]);
+							if (c[i] == 255) {
+								w.out.push_back(0);
+							}
+						}
 					}
-					bitBuf <<= 8;
-					bitCnt -= 8;
 				}
 			}
 
-			void jo_DCT(float &d0, float &d1, float &d2, float &d3, float &d4, float &d5, float &d6, float &d7) {
-				float tmp0 = d0 + d7;
-				float tmp7 = d0 - d7;
-				float tmp1 = d1 + d6;
-				float tmp6 = d1 - d6;
-				float tmp2 = d2 + d5;
-				float tmp5 = d2 - d5;
-				float tmp3 = d3 + d4;
-				float tmp4 = d3 - d4;
+			// write out the remaining whole bytes, a partial byte is dropped
+			void jo_flushBits(jo_writer &w) {
+				while (w.bitCnt >= 8) {
+					w.bitCnt -= 8;
+					unsigned char c = (unsigned char)(w.bitBuf >> w.bitCnt);
+					w.out.push_back(c);
+					if (c == 255) {
+						w.out.push_back(0);
+					}
+				}
+			}
+
+			// Integer forward DCT, the accurate "islow" variant of libjpeg's jfdctint.c.
+			// Samples are centered on zero, outputs are scaled up by 8. Constants are
+			// 13 bit fixed point, the row pass keeps 2 extra bits of precision.
+			const int JO_CONST_BITS = 13;
+			const int JO_PASS1_BITS = 2;
+			const int JO_FIX_0_298631336 = 2446;
+			const int JO_FIX_0_390180644 = 3196;
+			const int JO_FIX_0_541196100 = 4433;
+			const int JO_FIX_0_765366865 = 6270;
+			const int JO_FIX_0_899976223 = 7373;
+			const int JO_FIX_1_175875602 = 9633;
+			const int JO_FIX_1_501321110 = 12299;
+			const int JO_FIX_1_847759065 = 15137;
+			const int JO_FIX_1_961570560 = 16069;
+			const int JO_FIX_2_053119869 = 16819;
+			const int JO_FIX_2_562915447 = 20995;
+			const int JO_FIX_3_072711026 = 25172;
+
+			void jo_fdct_c(short *data) {
+				for (int pass = 0; pass < 2; ++pass) {
+					int shift = pass == 0 ? JO_CONST_BITS - JO_PASS1_BITS : JO_CONST_BITS + JO_PASS1_BITS;
+					int bias = 1 << (shift - 1);
+					for (int i = 0; i < 8; ++i) {
+						// rows first, then columns
+						short *d = pass == 0 ? data + i * 8 : data + i;
+						int s = pass == 0 ? 1 : 8;
+						int tmp0 = d[0] + d[7 * s];
+						int tmp7 = d[0] - d[7 * s];
+						int tmp1 = d[1 * s] + d[6 * s];
+						int tmp6 = d[1 * s] - d[6 * s];
+						int tmp2 = d[2 * s] + d[5 * s];
+						int tmp5 = d[2 * s] - d[5 * s];
+						int tmp3 = d[3 * s] + d[4 * s];
+						int tmp4 = d[3 * s] - d[4 * s];
+
+						// Even part
+						int tmp10 = tmp0 + tmp3;
+						int tmp13 = tmp0 - tmp3;
+						int tmp11 = tmp1 + tmp2;
+						int tmp12 = tmp1 - tmp2;
+
+						if (pass == 0) {
+							d[0] = (short)((tmp10 + tmp11) * (1 << JO_PASS1_BITS));
+							d[4 * s] = (short)((tmp10 - tmp11) * (1 << JO_PASS1_BITS));
+						}
+						else {
+							d[0] = (short)((tmp10 + tmp11 + (1 << (JO_PASS1_BITS - 1))) >> JO_PASS1_BITS);
+							d[4 * s] = (short)((tmp10 - tmp11 + (1 << (JO_PASS1_BITS - 1))) >> JO_PASS1_BITS);
+						}
+
+						int z1 = (tmp12 + tmp13) * JO_FIX_0_541196100;
+						d[2 * s] = (short)((z1 + tmp13 * JO_FIX_0_765366865 + bias) >> shift);
+						d[6 * s] = (short)((z1 - tmp12 * JO_FIX_1_847759065 + bias) >> shift);
 
-				// Even part
-				float tmp10 = tmp0 + tmp3;	// phase 2
-				float tmp13 = tmp0 - tmp3;
-				float tmp11 = tmp1 + tmp2;
-				float tmp12 = tmp1 - tmp2;
+						// Odd part
+						z1 = tmp4 + tmp7;
+						int z2 = tmp5 + tmp6;
+						int z3 = tmp4 + tmp6;
+						int z4 = tmp5 + tmp7;
+						int z5 = (z3 + z4) * JO_FIX_1_175875602;
 
-				d0 = tmp10 + tmp11; 		// phase 3
-				d4 = tmp10 - tmp11;
+						tmp4 *= JO_FIX_0_298631336;
+						tmp5 *= JO_FIX_2_053119869;
+						tmp6 *= JO_FIX_3_072711026;
+						tmp7 *= JO_FIX_1_501321110;
+						z1 *= -JO_FIX_0_899976223;
+						z2 *= -JO_FIX_2_562915447;
+						z3 = z3 * -JO_FIX_1_961570560 + z5;
+						z4 = z4 * -JO_FIX_0_390180644 + z5;
+
+						d[7 * s] = (short)((tmp4 + z1 + z3 + bias) >> shift);
+						d[5 * s] = (short)((tmp5 + z2 + z4 + bias) >> shift);
+						d[3 * s] = (short)((tmp6 + z2 + z3 + bias) >> shift);
+						d[1 * s] = (short)((tmp7 + z1 + z4 + bias) >> shift);
+					}
+				}
+			}
 
-				float z1 = (tmp12 + tmp13) * 0.707106781f; // c4
-				d2 = tmp13 + z1; 		// phase 5
-				d6 = tmp13 - z1;
+			// 14 bit fixed point BT.601 colour conversion, luma is centered for the DCT.
+			// Chroma rounds with just under one half so full scale values stay in [-128, 127].
+			const int JO_YCC_BITS = 14;
+			const int JO_YR = 4899, JO_YG = 9617, JO_YB = 1868;
+			const int JO_UR = -2765, JO_UG = -5427, JO_UB = 8192;
+			const int JO_VR = 8192, JO_VG = -6860, JO_VB = -1332;
 
-				// Odd part
-				tmp10 = tmp4 + tmp5; 		// phase 2
-				tmp11 = tmp5 + tmp6;
-				tmp12 = tmp6 + tmp7;
+			void jo_ycc_c(const short *r, const short *g, const short *b, short *Y, short *U, short *V) {
+				for (int i = 0; i < 64; ++i) {
+					Y[i] = (short)(((JO_YR * r[i] + JO_YG * g[i] + JO_YB * b[i] + (1 << (JO_YCC_BITS - 1))) >> JO_YCC_BITS) - 128);
+					U[i] = (short)((JO_UR * r[i] + JO_UG * g[i] + JO_UB * b[i] + (1 << (JO_YCC_BITS - 1)) - 1) >> JO_YCC_BITS);
+					V[i] = (short)((JO_VR * r[i] + JO_VG * g[i] + JO_VB * b[i] + (1 << (JO_YCC_BITS - 1)) - 1) >> JO_YCC_BITS);
+				}
+			}
 
-				// The rotator is modified from fig 4-8 to avoid extra negations.
-				float z5 = (tmp10 - tmp12) * 0.382683433f; // c6
-				float z2 = tmp10 * 0.541196100f + z5; // c2-c6
-				float z4 = tmp12 * 1.306562965f + z5; // c2+c6
-				float z3 = tmp11 * 0.707106781f; // c4
+			// quantize with reciprocal divisors, round half away from zero and zigzag
+			void jo_quantize_c(const short *coef, const float *fdtbl, int *DU) {
+				for (int i = 0; i < 64; ++i) {
+					float v = coef[i] * fdtbl[i];
+					DU[s_jo_ZigZag[i]] = (int)(v + (v < 0 ? -0.5f : 0.5f));
+				}
+			}
 
-				float z11 = tmp7 + z3;		// phase 5
-				float z13 = tmp7 - z3;
+#ifdef STBI_SSE2
+			// intrinsics headers are included by the embedded decoder, inside its namespace
+			using namespace stbi::decode;
 
-				d5 = z13 + z2;			// phase 6
-				d3 = z13 - z2;
-				d1 = z11 + z4;
-				d7 = z11 - z4;
+			// pmaddwd constant, element pairs (x, y) yield x * a + y * b
+			inline __m128i jo_pair_sse2(int a, int b) {
+				return _mm_set1_epi32((int)(((unsigned)b << 16) | ((unsigned)a & 0xffff)));
 			}
 
-			void jo_calcBits(int val, unsigned short bits[2]) {
-				int tmp1 = val < 0 ? -val : val;
-				val = val < 0 ? val - 1 : val;
-				bits[1] = 1;
-				while (tmp1 >>= 1) {
-					++bits[1];
+			// x * a + y * b for all 8 lanes, descaled and packed back to int16
+			inline __m128i jo_rot_sse2(__m128i xyLo, __m128i xyHi, __m128i c, __m128i addLo, __m128i addHi, __m128i bias, int shift) {
+				__m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(xyLo, c), addLo), bias);
+				__m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(xyHi, c), addHi), bias);
+				return _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+			}
+
+			// 8x8 int16 transpose, the interleave network of the decoder's idct
+			inline void jo_transpose_sse2(__m128i *r) {
+				static const int pairs[12][2] = { { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }, { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 }, { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 } };
+				for (int i = 0; i < 12; ++i) {
+					__m128i a = r[pairs[i][0]], b = r[pairs[i][1]];
+					r[pairs[i][0]] = _mm_unpacklo_epi16(a, b);
+					r[pairs[i][1]] = _mm_unpackhi_epi16(a, b);
 				}
-				bits[0] = val & ((1 << bits[1]) - 1);
 			}
 
-			int jo_processDU(FILE *fp, int &bitBuf, int &bitCnt, float *CDU, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
-				const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
-				const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
+			// One pass of jo_fdct_c on 8 lanes at once, the products are regrouped into
+			// pairs for pmaddwd but add up to exactly the same integers.
+			inline void jo_fdct_pass_sse2(__m128i *d, bool first) {
+				__m128i tmp0 = _mm_add_epi16(d[0], d[7]);
+				__m128i tmp7 = _mm_sub_epi16(d[0], d[7]);
+				__m128i tmp1 = _mm_add_epi16(d[1], d[6]);
+				__m128i tmp6 = _mm_sub_epi16(d[1], d[6]);
+				__m128i tmp2 = _mm_add_epi16(d[2], d[5]);
+				__m128i tmp5 = _mm_sub_epi16(d[2], d[5]);
+				__m128i tmp3 = _mm_add_epi16(d[3], d[4]);
+				__m128i tmp4 = _mm_sub_epi16(d[3], d[4]);
 
-				// DCT rows
-				for (int dataOff = 0; dataOff<64; dataOff += 8) {
-					jo_DCT(CDU[dataOff], CDU[dataOff + 1], CDU[dataOff + 2], CDU[dataOff + 3], CDU[dataOff + 4], CDU[dataOff + 5], CDU[dataOff + 6], CDU[dataOff + 7]);
+				int shift = first ? JO_CONST_BITS - JO_PASS1_BITS : JO_CONST_BITS + JO_PASS1_BITS;
+				__m128i bias = _mm_set1_epi32(1 << (shift - 1));
+				__m128i zero = _mm_setzero_si128();
+
+				// Even part
+				__m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+				__m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+				__m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+				__m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+
+				if (first) {
+					d[0] = _mm_slli_epi16(_mm_add_epi16(tmp10, tmp11), JO_PASS1_BITS);
+					d[4] = _mm_slli_epi16(_mm_sub_epi16(tmp10, tmp11), JO_PASS1_BITS);
 				}
-				// DCT columns
-				for (int dataOff = 0; dataOff<8; ++dataOff) {
-					jo_DCT(CDU[dataOff], CDU[dataOff + 8], CDU[dataOff + 16], CDU[dataOff + 24], CDU[dataOff + 32], CDU[dataOff + 40], CDU[dataOff + 48], CDU[dataOff + 56]);
+				else {
+					__m128i round = _mm_set1_epi16(1 << (JO_PASS1_BITS - 1));
+					d[0] = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(tmp10, tmp11), round), JO_PASS1_BITS);
+					d[4] = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(tmp10, tmp11), round), JO_PASS1_BITS);
+				}
+
+				__m128i e_lo = _mm_unpacklo_epi16(tmp13, tmp12);
+				__m128i e_hi = _mm_unpackhi_epi16(tmp13, tmp12);
+				d[2] = jo_rot_sse2(e_lo, e_hi, jo_pair_sse2(JO_FIX_0_541196100 + JO_FIX_0_765366865, JO_FIX_0_541196100), zero, zero, bias, shift);
+				d[6] = jo_rot_sse2(e_lo, e_hi, jo_pair_sse2(JO_FIX_0_541196100, JO_FIX_0_541196100 - JO_FIX_1_847759065), zero, zero, bias, shift);
+
+				// Odd part, z5 is folded into the z3/z4 rotation
+				__m128i z3 = _mm_add_epi16(tmp4, tmp6);
+				__m128i z4 = _mm_add_epi16(tmp5, tmp7);
+				__m128i z_lo = _mm_unpacklo_epi16(z3, z4);
+				__m128i z_hi = _mm_unpackhi_epi16(z3, z4);
+				__m128i c3 = jo_pair_sse2(JO_FIX_1_175875602 - JO_FIX_1_961570560, JO_FIX_1_175875602);
+				__m128i c4 = jo_pair_sse2(JO_FIX_1_175875602, JO_FIX_1_175875602 - JO_FIX_0_390180644);
+				__m128i z3_lo = _mm_madd_epi16(z_lo, c3), z3_hi = _mm_madd_epi16(z_hi, c3);
+				__m128i z4_lo = _mm_madd_epi16(z_lo, c4), z4_hi = _mm_madd_epi16(z_hi, c4);
+
+				__m128i o47_lo = _mm_unpacklo_epi16(tmp4, tmp7);
+				__m128i o47_hi = _mm_unpackhi_epi16(tmp4, tmp7);
+				__m128i o56_lo = _mm_unpacklo_epi16(tmp5, tmp6);
+				__m128i o56_hi = _mm_unpackhi_epi16(tmp5, tmp6);
+				d[7] = jo_rot_sse2(o47_lo, o47_hi, jo_pair_sse2(JO_FIX_0_298631336 - JO_FIX_0_899976223, -JO_FIX_0_899976223), z3_lo, z3_hi, bias, shift);
+				d[1] = jo_rot_sse2(o47_lo, o47_hi, jo_pair_sse2(-JO_FIX_0_899976223, JO_FIX_1_501321110 - JO_FIX_0_899976223), z4_lo, z4_hi, bias, shift);
+				d[5] = jo_rot_sse2(o56_lo, o56_hi, jo_pair_sse2(JO_FIX_2_053119869 - JO_FIX_2_562915447, -JO_FIX_2_562915447), z4_lo, z4_hi, bias, shift);
+				d[3] = jo_rot_sse2(o56_lo, o56_hi, jo_pair_sse2(-JO_FIX_2_562915447, JO_FIX_3_072711026 - JO_FIX_2_562915447), z3_lo, z3_hi, bias, shift);
+			}
+
+			// same results as jo_fdct_c, inputs within [-128, 127] never overflow int16
+			void jo_fdct_sse2(short *data) {
+				__m128i d[8];
+				for (int i = 0; i < 8; ++i) {
+					d[i] = _mm_loadu_si128((const __m128i *)(data + i * 8));
+				}
+				jo_transpose_sse2(d);
+				jo_fdct_pass_sse2(d, true);
+				jo_transpose_sse2(d);
+				jo_fdct_pass_sse2(d, false);
+				for (int i = 0; i < 8; ++i) {
+					_mm_storeu_si128((__m128i *)(data + i * 8), d[i]);
+				}
+			}
+
+			void jo_ycc_sse2(const short *r, const short *g, const short *b, short *Y, short *U, short *V) {
+				const __m128i one = _mm_set1_epi16(1);
+				const __m128i center = _mm_set1_epi16(128);
+				const __m128i yrg = jo_pair_sse2(JO_YR, JO_YG), yb = jo_pair_sse2(JO_YB, 1 << (JO_YCC_BITS - 1));
+				const __m128i urg = jo_pair_sse2(JO_UR, JO_UG), ub = jo_pair_sse2(JO_UB, (1 << (JO_YCC_BITS - 1)) - 1);
+				const __m128i vrg = jo_pair_sse2(JO_VR, JO_VG), vb = jo_pair_sse2(JO_VB, (1 << (JO_YCC_BITS - 1)) - 1);
+				for (int i = 0; i < 64; i += 8) {
+					__m128i rr = _mm_loadu_si128((const __m128i *)(r + i));
+					__m128i gg = _mm_loadu_si128((const __m128i *)(g + i));
+					__m128i bb = _mm_loadu_si128((const __m128i *)(b + i));
+					__m128i rg_lo = _mm_unpacklo_epi16(rr, gg), rg_hi = _mm_unpackhi_epi16(rr, gg);
+					__m128i b1_lo = _mm_unpacklo_epi16(bb, one), b1_hi = _mm_unpackhi_epi16(bb, one);
+					__m128i y = _mm_packs_epi32(
+						_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg_lo, yrg), _mm_madd_epi16(b1_lo, yb)), JO_YCC_BITS),
+						_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg_hi, yrg), _mm_madd_epi16(b1_hi, yb)), JO_YCC_BITS));
+					__m128i u = _mm_packs_epi32(
+						_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg_lo, urg), _mm_madd_epi16(b1_lo, ub)), JO_YCC_BITS),
+						_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg_hi, urg), _mm_madd_epi16(b1_hi, ub)), JO_YCC_BITS));
+					__m128i v = _mm_packs_epi32(
+						_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg_lo, vrg), _mm_madd_epi16(b1_lo, vb)), JO_YCC_BITS),
+						_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg_hi, vrg), _mm_madd_epi16(b1_hi, vb)), JO_YCC_BITS));
+					_mm_storeu_si128((__m128i *)(Y + i), _mm_sub_epi16(y, center));
+					_mm_storeu_si128((__m128i *)(U + i), u);
+					_mm_storeu_si128((__m128i *)(V + i), v);
+				}
+			}
+
+			void jo_quantize_sse2(const short *coef, const float *fdtbl, int *DU) {
+				const __m128i signMask = _mm_set1_epi32((int)0x80000000u);
+				const __m128 half = _mm_set1_ps(0.5f);
+				int q[64];
+				for (int i = 0; i < 64; i += 8) {
+					__m128i c = _mm_loadu_si128((const __m128i *)(coef + i));
+					__m128i c_lo = _mm_srai_epi32(_mm_unpacklo_epi16(c, c), 16);
+					__m128i c_hi = _mm_srai_epi32(_mm_unpackhi_epi16(c, c), 16);
+					__m128 v_lo = _mm_mul_ps(_mm_cvtepi32_ps(c_lo), _mm_loadu_ps(fdtbl + i));
+					__m128 v_hi = _mm_mul_ps(_mm_cvtepi32_ps(c_hi), _mm_loadu_ps(fdtbl + i + 4));
+					// truncate v +- 0.5, the sign of v picks the direction
+					__m128 h_lo = _mm_or_ps(half, _mm_and_ps(v_lo, _mm_castsi128_ps(signMask)));
+					__m128 h_hi = _mm_or_ps(half, _mm_and_ps(v_hi, _mm_castsi128_ps(signMask)));
+					_mm_storeu_si128((__m128i *)(q + i), _mm_cvttps_epi32(_mm_add_ps(v_lo, h_lo)));
+					_mm_storeu_si128((__m128i *)(q + i + 4), _mm_cvttps_epi32(_mm_add_ps(v_hi, h_hi)));
 				}
-				// Quantize/descale/zigzag the coefficients
-				int DU[64];
-				for (int i = 0; i<64; ++i) {
-					float v = CDU[i] * fdtbl[i];
-					DU[s_jo_ZigZag[i]] = (int)(v < 0 ? ceilf(v - 0.5f) : floorf(v + 0.5f));
+				for (int i = 0; i < 64; ++i) {
+					DU[s_jo_ZigZag[i]] = q[i];
 				}
+			}
+#endif
+
+			struct jo_kernels
+			{
+				void(*ycc)(const short *, const short *, const short *, short *, short *, short *);
+				void(*fdct)(short *);
+				void(*quantize)(const short *, const float *, int *);
+			};
+
+			const jo_kernels &jo_get_kernels() {
+				static const jo_kernels kernels = []() -> jo_kernels {
+#ifdef STBI_SSE2
+					if (stbi::decode::stbi__sse2_available()) {
+						jo_kernels k = { jo_ycc_sse2, jo_fdct_sse2, jo_quantize_sse2 };
+						return k;
+					}
+#endif
+					jo_kernels k = { jo_ycc_c, jo_fdct_c, jo_quantize_c };
+					return k;
+				}();
+				return kernels;
+			}
+
+			void jo_calcBits(int val, unsigned short bits[2]) {
+				int tmp1 = val < 0 ? -val : val;
+				val = val < 0 ? val - 1 : val;
+				bits[1] = 1;
+				while (tmp1 >>= 1) {
+					++bits[1];
+				}
+				bits[0] = val & ((1 << bits[1]) - 1);
+			}
+
+			int jo_processDU(jo_writer &w, short *CDU, const float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+				const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
+				const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
+				const jo_kernels &kernels = jo_get_kernels();
+
+				// DCT, quantize/descale/zigzag the coefficients
+				kernels.fdct(CDU);
+				int DU[64];
+				kernels.quantize(CDU, fdtbl, DU);
 
 				// Encode DC
 				int diff = DU[0] - DC;
 				if (diff == 0) {
-					jo_writeBits(fp, bitBuf, bitCnt, HTDC[0]);
+					jo_writeBits(w, HTDC[0]);
 				}
 				else {
 					unsigned short bits[2];
 					jo_calcBits(diff, bits);
-					jo_writeBits(fp, bitBuf, bitCnt, HTDC[bits[1]]);
-					jo_writeBits(fp, bitBuf, bitCnt, bits);
+					jo_writeBits(w, HTDC[bits[1]]);
+					jo_writeBits(w, bits);
 				}
 				// Encode ACs
 				int end0pos = 63;
@@ -10159,7 +11205,7 @@ namespace zz
 				}
 				// end0pos = first element in reverse order !=0
 				if (end0pos == 0) {
-					jo_writeBits(fp, bitBuf, bitCnt, EOB);
+					jo_writeBits(w, EOB);
 					return DU[0];
 				}
 				for (int i = 1; i <= end0pos; ++i) {
@@ -10170,21 +11216,22 @@ namespace zz
 					if (nrzeroes >= 16) {
 						int lng = nrzeroes >> 4;
 						for (int nrmarker = 1; nrmarker <= lng; ++nrmarker)
-							jo_writeBits(fp, bitBuf, bitCnt, M16zeroes);
+							jo_writeBits(w, M16zeroes);
 						nrzeroes &= 15;
 					}
 					unsigned short bits[2];
 					jo_calcBits(DU[i], bits);
-					jo_writeBits(fp, bitBuf, bitCnt, HTAC[(nrzeroes << 4) + bits[1]]);
-					jo_writeBits(fp, bitBuf, bitCnt, bits);
+					jo_writeBits(w, HTAC[(nrzeroes << 4) + bits[1]]);
+					jo_writeBits(w, bits);
 				}
 				if (end0pos != 63) {
-					jo_writeBits(fp, bitBuf, bitCnt, EOB);
+					jo_writeBits(w, EOB);
 				}
 				return DU[0];
 			}
 
-			bool jo_write_jpg(const char *filename, const void *data, int width, int height, int comp, int quality) {
+			// Appends the JPEG stream to out. Rows are stride bytes apart, 0 for packed rows.
+			bool jo_write_jpg_to_mem(std::vector<unsigned char> &out, const void *data, int width, int height, int comp, int quality, int stride = 0) {
 				// Constants that don't pollute global namespace
 				const unsigned char std_dc_luminance_nrcodes[] = { 0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
 				const unsigned char std_dc_luminance_values[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
@@ -10251,15 +11298,12 @@ namespace zz
 				};
 				const int YQT[] = { 16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62, 18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99 };
 				const int UVQT[] = { 17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99 };
-				const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f, 1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
-				if (!data || !filename || !width || !height || comp > 4 || comp < 1 || comp == 2) {
+				if (!data || !width || !height || comp > 4 || comp < 1 || comp == 2) {
 					return false;
 				}
-
-				FILE *fp = fopen(filename, "wb");
-				if (!fp) {
-					return false;
+				if (!stride) {
+					stride = width * comp;
 				}
 
 				quality = quality ? quality : 90;
@@ -10274,78 +11318,89 @@ namespace zz
 					UVTable[s_jo_ZigZag[i]] = uvti < 1 ? 1 : uvti > 255 ? 255 : uvti;
 				}
 
+				// the dct output is scaled up by 8
 				float fdtbl_Y[64], fdtbl_UV[64];
-				for (int row = 0, k = 0; row < 8; ++row) {
-					for (int col = 0; col < 8; ++col, ++k) {
-						fdtbl_Y[k] = 1 / (YTable[s_jo_ZigZag[k]] * aasf[row] * aasf[col]);
-						fdtbl_UV[k] = 1 / (UVTable[s_jo_ZigZag[k]] * aasf[row] * aasf[col]);
-					}
+				for (int k = 0; k < 64; ++k) {
+					fdtbl_Y[k] = 1.0f / (YTable[s_jo_ZigZag[k]] * 8);
+					fdtbl_UV[k] = 1.0f / (UVTable[s_jo_ZigZag[k]] * 8);
 				}
 
+				// rough guess of the compressed size, saves most regrowth of the buffer
+				jo_writer w(out);
+				out.reserve(out.size() + 1024 + (std::size_t)width * height / 4);
+
 				// Write Headers
 				const unsigned char head0[] = { 0xFF, 0xD8, 0xFF, 0xE0, 0, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0, 0xFF, 0xDB, 0, 0x84, 0 };
-				fwrite(head0, sizeof(head0), 1, fp);
-				fwrite(YTable, sizeof(YTable), 1, fp);
-				putc(1, fp);
-				fwrite(UVTable, sizeof(UVTable), 1, fp);
+				w.write(head0, sizeof(head0));
+				w.write(YTable, sizeof(YTable));
+				w.put(1);
+				w.write(UVTable, sizeof(UVTable));
 				const unsigned char head1[] = { 0xFF, 0xC0, 0, 0x11, 8, (unsigned char)(height >> 8), (unsigned char)(height & 0xFF), (unsigned char)(width >> 8), (unsigned char)(width & 0xFF), 3, 1, 0x11, 0, 2, 0x11, 1, 3, 0x11, 1, 0xFF, 0xC4, 0x01, 0xA2, 0 };
-				fwrite(head1, sizeof(head1), 1, fp);
-				fwrite(std_dc_luminance_nrcodes + 1, sizeof(std_dc_luminance_nrcodes)-1, 1, fp);
-				fwrite(std_dc_luminance_values, sizeof(std_dc_luminance_values), 1, fp);
-				putc(0x10, fp); // HTYACinfo
-				fwrite(std_ac_luminance_nrcodes + 1, sizeof(std_ac_luminance_nrcodes)-1, 1, fp);
-				fwrite(std_ac_luminance_values, sizeof(std_ac_luminance_values), 1, fp);
-				putc(1, fp); // HTUDCinfo
-				fwrite(std_dc_chrominance_nrcodes + 1, sizeof(std_dc_chrominance_nrcodes)-1, 1, fp);
-				fwrite(std_dc_chrominance_values, sizeof(std_dc_chrominance_values), 1, fp);
-				putc(0x11, fp); // HTUACinfo
-				fwrite(std_ac_chrominance_nrcodes + 1, sizeof(std_ac_chrominance_nrcodes)-1, 1, fp);
-				fwrite(std_ac_chrominance_values, sizeof(std_ac_chrominance_values), 1, fp);
+				w.write(head1, sizeof(head1));
+				w.write(std_dc_luminance_nrcodes + 1, sizeof(std_dc_luminance_nrcodes)-1);
+				w.write(std_dc_luminance_values, sizeof(std_dc_luminance_values));
+				w.put(0x10); // HTYACinfo
+				w.write(std_ac_luminance_nrcodes + 1, sizeof(std_ac_luminance_nrcodes)-1);
+				w.write(std_ac_luminance_values, sizeof(std_ac_luminance_values));
+				w.put(1); // HTUDCinfo
+				w.write(std_dc_chrominance_nrcodes + 1, sizeof(std_dc_chrominance_nrcodes)-1);
+				w.write(std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+				w.put(0x11); // HTUACinfo
+				w.write(std_ac_chrominance_nrcodes + 1, sizeof(std_ac_chrominance_nrcodes)-1);
+				w.write(std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
 				const unsigned char head2[] = { 0xFF, 0xDA, 0, 0xC, 3, 1, 0, 2, 0x11, 3, 0x11, 0, 0x3F, 0 };
-				fwrite(head2, sizeof(head2), 1, fp);
+				w.write(head2, sizeof(head2));
 
 				// Encode 8x8 macroblocks
 				const unsigned char *imageData = (const unsigned char *)data;
+				const jo_kernels &kernels = jo_get_kernels();
 				int DCY = 0, DCU = 0, DCV = 0;
-				int bitBuf = 0, bitCnt = 0;
 				int ofsG = comp > 1 ? 1 : 0, ofsB = comp > 1 ? 2 : 0;
 				for (int y = 0; y < height; y += 8) {
 					for (int x = 0; x < width; x += 8) {
-						float YDU[64], UDU[64], VDU[64];
-						for (int row = y, pos = 0; row < y + 8; ++row) {
-							for (int col = x; col < x + 8; ++col, ++pos) {
-								int p = row*width*comp + col*comp;
-								if (row >= height) {
-									p -= width*comp*(row + 1 - height);
-								}
-								if (col >= width) {
-									p -= comp*(col + 1 - width);
-								}
-
-								float r = imageData[p + 0], g = imageData[p + ofsG], b = imageData[p + ofsB];
-								YDU[pos] = +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-								UDU[pos] = -0.16874f*r - 0.33126f*g + 0.50000f*b;
-								VDU[pos] = +0.50000f*r - 0.41869f*g - 0.08131f*b;
+						short R[64], G[64], B[64];
+						short YDU[64], UDU[64], VDU[64];
+						// blocks over the border repeat the last row and column
+						for (int row = 0, pos = 0; row < 8; ++row) {
+							const unsigned char *line = imageData + (std::size_t)(y + row < height ? y + row : height - 1) * stride;
+							for (int col = 0; col < 8; ++col, ++pos) {
+								const unsigned char *p = line + (x + col < width ? x + col : width - 1) * comp;
+								R[pos] = p[0];
+								G[pos] = p[ofsG];
+								B[pos] = p[ofsB];
 							}
 						}
+						kernels.ycc(R, G, B, YDU, UDU, VDU);
 
-						DCY = jo_processDU(fp, bitBuf, bitCnt, YDU, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-						DCU = jo_processDU(fp, bitBuf, bitCnt, UDU, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-						DCV = jo_processDU(fp, bitBuf, bitCnt, VDU, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+						DCY = jo_processDU(w, YDU, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+						DCU = jo_processDU(w, UDU, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
+						DCV = jo_processDU(w, VDU, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
 					}
 				}
 
 				// Do the bit alignment of the EOI marker
 				const unsigned short fillBits[] = { 0x7F, 7 };
-				jo_writeBits(fp, bitBuf, bitCnt, fillBits);
+				jo_writeBits(w, fillBits);
+				jo_flushBits(w);
 
 				// EOI
-				putc(0xFF, fp);
-				putc(0xD9, fp);
-
-				fclose(fp);
+				w.put(0xFF);
+				w.put(0xD9);
 				return true;
 			}
+
+			bool jo_write_jpg(const char *filename, const void *data, int width, int height, int comp, int quality) {
+				std::vector<unsigned char> buffer;
+				if (!filename || !jo_write_jpg_to_mem(buffer, data, width, height, comp, quality)) {
+					return false;
+				}
+				FILE *fp = fopen(filename, "wb");
+				if (!fp) {
+					return false;
+				}
+				bool ok = fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+				return fclose(fp) == 0 && ok;
+			}
 		} // namespace jo
 	}
 	// \endcond
@@ -12222,6 +13277,60 @@ namespace zz
 		RWLock::LockType RWLock::get_lock_type() const {
 			return lockType_;
 		}
+
+		ThreadPool::ThreadPool(unsigned numThreads) : stop_(false)
+		{
+			if (numThreads < 1) numThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+			for (unsigned i = 0; i < numThreads; ++i)
+			{
+				workers_.emplace_back(&ThreadPool::worker, this);
+			}
+		}
+
+		ThreadPool::~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			cond_.notify_all();
+			for (auto& t : workers_)
+			{
+				if (t.joinable()) t.join();
+			}
+		}
+
+		void ThreadPool::post(std::function<void()> task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (stop_) throw RuntimeException("Posting task to stopped thread pool!");
+				tasks_.push_back(std::move(task));
+			}
+			cond_.notify_one();
+		}
+
+		std::size_t ThreadPool::pending()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return tasks_.size();
+		}
+
+		void ThreadPool::worker()
+		{
+			while (true)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					cond_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+					if (tasks_.empty()) return;	// stopped and drained
+					task = std::move(tasks_.front());
+					tasks_.pop_front();
+				}
+				task();
+			}
+		}
 	} // namespace cds
 
 	namespace cfg
@@ -12471,6 +13580,7 @@ namespace zz
 			else
 			{
 				ret = "<" + type_ + ">";
+				if (max_ < 0 || max_ > 1) ret += "...";
 				return ret;
 			}
 
@@ -12481,7 +13591,7 @@ namespace zz
 				if (required_) ret.push_back('=');
 				else ret.push_back(' ');
 				ret += st;
-				for (int i = 2; i < min_; ++i)
+				for (int i = 1; i < min_; ++i)
 				{
 					ret.push_back(' ');
 					ret += st;
@@ -12760,11 +13870,12 @@ namespace zz
 			{
 				if (o->shortKey_ == -1 && o->longKey_.empty())
 				{
-					int n = o->max_;
-					while (n > 0 && args_.size() > 0)
+					int n = o->max_;	// -1 takes all remaining
+					while (n != 0 && args_.size() > 0)
 					{
 						o->val_ = o->val_.str() + " " + args_[0].str();
 						++o->count_;
+						++o->size_;
 						--n;
 						args_.erase(args_.begin());
 					}
@@ -13762,46 +14873,473 @@ namespace zz
 
 	} // namespace log
 
+	namespace detail
+	{
+		namespace
+		{
+			const std::size_t kPixelAlign = 64;
+			// smaller blocks are left to malloc, it handles those well
+			const std::size_t kPixelPoolMinBytes = 4096;
+
+			// Free lists keyed by rounded size, four classes per power of two keep
+			// the waste under 25%. Never destroyed, images may outlive static data.
+			struct PixelPool
+			{
+				std::mutex mutex;
+				std::map<std::size_t, std::vector<void*>> blocks;
+				std::size_t cached = 0;
+				std::size_t limit = 256 << 20;
+			};
+
+			PixelPool& pixel_pool()
+			{
+				static PixelPool* pool = new PixelPool;
+				return *pool;
+			}
+
+			std::size_t pixel_bucket(std::size_t bytes)
+			{
+				if (bytes <= kPixelPoolMinBytes) return bytes;
+				int bits = 0;
+				while ((static_cast<std::size_t>(1) << bits) < bytes) ++bits;
+				std::size_t step = static_cast<std::size_t>(1) << (bits - 3);
+				return (bytes + step - 1) / step * step;
+			}
+
+			void* aligned_alloc_raw(std::size_t bytes)
+			{
+				// raw pointer is kept right before the aligned block
+				void* raw = std::malloc(bytes + kPixelAlign - 1 + sizeof(void*));
+				if (!raw) throw std::bad_alloc();
+				std::uintptr_t addr = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + kPixelAlign - 1) & ~(kPixelAlign - 1);
+				reinterpret_cast<void**>(addr)[-1] = raw;
+				return reinterpret_cast<void*>(addr);
+			}
+
+			void aligned_free_raw(void* ptr)
+			{
+				std::free(static_cast<void**>(ptr)[-1]);
+			}
+		}
+
+		void* pixel_alloc(std::size_t bytes)
+		{
+			std::size_t size = pixel_bucket(bytes);
+			if (size > kPixelPoolMinBytes)
+			{
+				PixelPool& pool = pixel_pool();
+				std::lock_guard<std::mutex> lock(pool.mutex);
+				auto it = pool.blocks.find(size);
+				if (it != pool.blocks.end() && !it->second.empty())
+				{
+					void* ptr = it->second.back();
+					it->second.pop_back();
+					pool.cached -= size;
+					return ptr;
+				}
+			}
+			return aligned_alloc_raw(size);
+		}
+
+		void pixel_free(void* ptr, std::size_t bytes)
+		{
+			if (!ptr) return;
+			std::size_t size = pixel_bucket(bytes);
+			if (size > kPixelPoolMinBytes)
+			{
+				PixelPool& pool = pixel_pool();
+				std::lock_guard<std::mutex> lock(pool.mutex);
+				if (pool.cached + size <= pool.limit)
+				{
+					pool.blocks[size].push_back(ptr);
+					pool.cached += size;
+					return;
+				}
+			}
+			aligned_free_raw(ptr);
+		}
+
+		void pixel_pool_limit(std::size_t bytes)
+		{
+			PixelPool& pool = pixel_pool();
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			pool.limit = bytes;
+			// drop largest blocks first until under the new limit
+			for (auto it = pool.blocks.rbegin(); it != pool.blocks.rend() && pool.cached > pool.limit; ++it)
+			{
+				while (!it->second.empty() && pool.cached > pool.limit)
+				{
+					aligned_free_raw(it->second.back());
+					it->second.pop_back();
+					pool.cached -= it->first;
+				}
+			}
+		}
+	} // namespace detail
+
 	Image::Image(const char* filename)
 	{
 		load(filename);
 	}
 
-	void Image::load(const char* filename)
+	unsigned char* Image::decode_storage(void* user, int x, int y, int comp)
+	{
+		Image* self = static_cast<Image*>(user);
+		std::size_t size = static_cast<std::size_t>(x) * y * comp;
+		try
+		{
+			if (self->data_ && self->data_.use_count() == 1)
+			{
+				// sole owner, reuse old buffer, no reallocation unless it grows
+				self->data_->resize(size);
+				self->rows_ = y;
+				self->cols_ = x;
+				self->channels_ = comp;
+			}
+			else
+			{
+				self->create(y, x, comp);
+			}
+		}
+		catch (...)
+		{
+			return nullptr;	// reported as out of memory by decoder
+		}
+		return self->data_->data();
+	}
+
+	void Image::decode_finish(unsigned char* buffer, int x, int y, int comp)
+	{
+		// jpeg writes directly into storage, other formats come in a malloc'ed buffer
+		if (data_ && buffer == data_->data() && rows_ == y && cols_ == x && channels_ == comp) return;
+		import(buffer, y, x, comp);
+		thirdparty::stbi::decode::stbi_image_free(buffer);
+	}
+
+	namespace
+	{
+		std::atomic<int> imageDecodeThreads(1);
+		std::atomic<std::size_t> imageMaxPixels(0);
+
+		// header only size check, before any pixel buffer is allocated
+		void check_pixels(const Image::Info& info, const std::string& source)
+		{
+			std::size_t limit = imageMaxPixels;
+			if (static_cast<std::size_t>(info.rows) * static_cast<std::size_t>(info.cols) > limit)
+			{
+				throw ArgException("Image too large, " + std::to_string(info.cols) + "x" + std::to_string(info.rows)
+					+ " exceeds " + std::to_string(limit) + " pixels: " + source);
+			}
+		}
+
+		void check_pixels(const char* filename)
+		{
+			if (imageMaxPixels > 0) check_pixels(Image::probe(filename), filename);
+		}
+
+		void check_pixels(const unsigned char* data, std::size_t len)
+		{
+			if (imageMaxPixels > 0) check_pixels(Image::probe(data, len), "encoded buffer");
+		}
+	}
+
+	Image::Info Image::probe(const char* filename)
+	{
+		Info info;
+		if (!thirdparty::stbi::decode::stbi_info(filename, &info.cols, &info.rows, &info.channels))
+		{
+			std::string msg = "Failed to probe " + std::string(filename) + ": ";
+			msg += thirdparty::stbi::decode::stbi_failure_reason();
+			throw RuntimeException(msg);
+		}
+		return info;
+	}
+
+	Image::Info Image::probe(const unsigned char* data, std::size_t len)
+	{
+		Info info;
+		if (len > static_cast<std::size_t>(INT_MAX)) throw ArgException("Encoded buffer too large");
+		if (!thirdparty::stbi::decode::stbi_info_from_memory(data, static_cast<int>(len), &info.cols, &info.rows, &info.channels))
+		{
+			std::string msg = "Failed to probe from memory: ";
+			msg += thirdparty::stbi::decode::stbi_failure_reason();
+			throw RuntimeException(msg);
+		}
+		return info;
+	}
+
+	void Image::set_max_pixels(std::size_t pixels)
 	{
+		imageMaxPixels = pixels;
+	}
+
+	void Image::set_decode_threads(int threads)
+	{
+		imageDecodeThreads = threads > 0 ? threads : 1;
+		thirdparty::stbi::decode::stbi_set_jpeg_decode_threads(imageDecodeThreads);
+	}
+
+	void Image::set_buffer_pool_limit(std::size_t bytes)
+	{
+		detail::pixel_pool_limit(bytes);
+	}
+
+	void Image::load(const char* filename, int min_rows, int min_cols)
+	{
+		if (imageDecodeThreads > 1)
+		{
+			// restart segments are located by scanning ahead, which needs the whole file in memory
+			std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+			std::streamoff size = fin ? static_cast<std::streamoff>(fin.tellg()) : -1;
+			if (size >= 0)
+			{
+				std::vector<unsigned char> bytes(static_cast<std::size_t>(size));
+				fin.seekg(0, std::ios::beg);
+				if (fin.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+				{
+					decode(bytes.data(), bytes.size(), min_rows, min_cols);
+					return;
+				}
+			}
+		}
+		check_pixels(filename);
 		int x;
 		int y;
 		int comp;
 		Image::value_type *buffer = nullptr;
-		buffer = thirdparty::stbi::decode::stbi_load(filename, &x, &y, &comp, 0);
+		thirdparty::stbi::decode::stbi_load_options opt = { min_cols, min_rows, &Image::decode_storage, this, nullptr, nullptr };
+		buffer = thirdparty::stbi::decode::stbi_load_ex(filename, &x, &y, &comp, 0, &opt);
 		if (!buffer)
 		{
 			std::string msg = "Failed to load from " + std::string(filename) + ": ";
 			msg += thirdparty::stbi::decode::stbi_failure_reason();
 			throw RuntimeException(msg);
 		};
-		import(buffer, y, x, comp);
+		decode_finish(buffer, x, y, comp);
+	}
+
+	void Image::decode(const unsigned char* data, std::size_t len, int min_rows, int min_cols)
+	{
+		int x;
+		int y;
+		int comp;
+		Image::value_type *buffer = nullptr;
+		if (len > static_cast<std::size_t>(INT_MAX)) throw ArgException("Encoded buffer too large");
+		check_pixels(data, len);
+		thirdparty::stbi::decode::stbi_load_options opt = { min_cols, min_rows, &Image::decode_storage, this, nullptr, nullptr };
+		buffer = thirdparty::stbi::decode::stbi_load_from_memory_ex(data, static_cast<int>(len), &x, &y, &comp, 0, &opt);
+		if (!buffer)
+		{
+			std::string msg = "Failed to decode from memory: ";
+			msg += thirdparty::stbi::decode::stbi_failure_reason();
+			throw RuntimeException(msg);
+		};
+		decode_finish(buffer, x, y, comp);
+	}
+
+	namespace
+	{
+		/*!
+		 * \brief Area (box filter) resampler fed one source row at a time.
+		 * Source and destination pixels are mapped onto a common integer grid, so
+		 * overlaps are exact and every destination pixel is finished by the source
+		 * row that completes it. Besides the destination only one filtered source
+		 * row and one accumulator row are kept.
+		 */
+		class AreaResampler
+		{
+		public:
+			AreaResampler(Image& dst, int rows, int cols) : dst_(dst), rows_(rows), cols_(cols), srcRows_(0), channels_(0), outRow_(0) {}
+
+			static void push(void* user, int y, int xSize, int ySize, int comp, const unsigned char* pixels)
+			{
+				static_cast<AreaResampler*>(user)->push_row(y, xSize, ySize, comp, pixels);
+			}
+
+		private:
+			void begin(int xSize, int ySize, int comp)
+			{
+				srcRows_ = ySize;
+				channels_ = comp;
+				outRow_ = 0;
+				dst_.create(rows_, cols_, comp);
+				hrow_.assign(static_cast<std::size_t>(cols_) * comp, 0.f);
+				acc_.assign(hrow_.size(), 0.f);
+
+				// horizontal taps, source col i spans [i * cols, (i + 1) * cols) and
+				// destination col o spans [o * xSize, (o + 1) * xSize)
+				tapBegin_.resize(cols_ + 1);
+				tapCol_.clear();
+				tapWeight_.clear();
+				for (int o = 0; o < cols_; ++o)
+				{
+					long long lo = static_cast<long long>(o) * xSize;
+					long long hi = lo + xSize;
+					tapBegin_[o] = static_cast<int>(tapCol_.size());
+					for (long long i = lo / cols_; i * cols_ < hi; ++i)
+					{
+						long long overlap = (std::min)(hi, (i + 1) * cols_) - (std::max)(lo, i * cols_);
+						tapCol_.push_back(static_cast<int>(i));
+						tapWeight_.push_back(static_cast<float>(overlap) / xSize);
+					}
+				}
+				tapBegin_[cols_] = static_cast<int>(tapCol_.size());
+			}
+
+			void push_row(int y, int xSize, int ySize, int comp, const unsigned char* pixels)
+			{
+				if (y == 0) begin(xSize, ySize, comp);
+				int rowSize = cols_ * channels_;
+
+				// horizontal pass
+				for (int o = 0; o < cols_; ++o)
+				{
+					float* h = &hrow_[o * channels_];
+					for (int c = 0; c < channels_; ++c) h[c] = 0.f;
+					for (int t = tapBegin_[o]; t < tapBegin_[o + 1]; ++t)
+					{
+						const unsigned char* p = pixels + tapCol_[t] * channels_;
+						float w = tapWeight_[t];
+						for (int c = 0; c < channels_; ++c) h[c] += w * p[c];
+					}
+				}
+
+				// vertical pass, source row y spans [y * rows, (y + 1) * rows) and
+				// destination row o spans [o * srcRows, (o + 1) * srcRows)
+				long long lo = static_cast<long long>(y) * rows_;
+				long long hi = lo + rows_;
+				while (outRow_ < rows_)
+				{
+					long long oLo = static_cast<long long>(outRow_) * srcRows_;
+					long long oHi = oLo + srcRows_;
+					if (oLo >= hi) break;
+					float w = static_cast<float>((std::min)(hi, oHi) - (std::max)(lo, oLo)) / srcRows_;
+					for (int i = 0; i < rowSize; ++i) acc_[i] += w * hrow_[i];
+					if (oHi > hi) break;	// rest of this row comes from the next source rows
+
+					unsigned char* out = &dst_(outRow_, 0);
+					for (int i = 0; i < rowSize; ++i)
+					{
+						float v = acc_[i] + 0.5f;
+						out[i] = static_cast<unsigned char>(v < 0.f ? 0.f : (v > 255.f ? 255.f : v));
+						acc_[i] = 0.f;
+					}
+					++outRow_;
+				}
+			}
+
+			Image& dst_;
+			int rows_;
+			int cols_;
+			int srcRows_;
+			int channels_;
+			int outRow_;
+			std::vector<int> tapBegin_;
+			std::vector<int> tapCol_;
+			std::vector<float> tapWeight_;
+			std::vector<float> hrow_;
+			std::vector<float> acc_;
+		};
+	}
+
+	void Image::load_resized(const char* filename, int height, int width)
+	{
+		assert(height > 0 && "height must > 0!");
+		assert(width > 0 && "width must > 0!");
+		if (imageDecodeThreads > 1)
+		{
+			// restart segments are located by scanning ahead, which needs the whole file in memory
+			std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+			std::streamoff size = fin ? static_cast<std::streamoff>(fin.tellg()) : -1;
+			if (size >= 0)
+			{
+				std::vector<unsigned char> bytes(static_cast<std::size_t>(size));
+				fin.seekg(0, std::ios::beg);
+				if (fin.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+				{
+					decode_resized(bytes.data(), bytes.size(), height, width);
+					return;
+				}
+			}
+		}
+		int x;
+		int y;
+		int comp;
+		check_pixels(filename);
+		AreaResampler sampler(*this, height, width);
+		thirdparty::stbi::decode::stbi_load_options opt = { width, height, nullptr, nullptr, &AreaResampler::push, &sampler };
+		Image::value_type *buffer = thirdparty::stbi::decode::stbi_load_ex(filename, &x, &y, &comp, 0, &opt);
+		if (!buffer)
+		{
+			std::string msg = "Failed to load from " + std::string(filename) + ": ";
+			msg += thirdparty::stbi::decode::stbi_failure_reason();
+			throw RuntimeException(msg);
+		};
+		thirdparty::stbi::decode::stbi_image_free(buffer);
+	}
+
+	void Image::decode_resized(const unsigned char* data, std::size_t len, int height, int width)
+	{
+		assert(height > 0 && "height must > 0!");
+		assert(width > 0 && "width must > 0!");
+		int x;
+		int y;
+		int comp;
+		if (len > static_cast<std::size_t>(INT_MAX)) throw ArgException("Encoded buffer too large");
+		check_pixels(data, len);
+		AreaResampler sampler(*this, height, width);
+		thirdparty::stbi::decode::stbi_load_options opt = { width, height, nullptr, nullptr, &AreaResampler::push, &sampler };
+		Image::value_type *buffer = thirdparty::stbi::decode::stbi_load_from_memory_ex(data, static_cast<int>(len), &x, &y, &comp, 0, &opt);
+		if (!buffer)
+		{
+			std::string msg = "Failed to decode from memory: ";
+			msg += thirdparty::stbi::decode::stbi_failure_reason();
+			throw RuntimeException(msg);
+		};
 		thirdparty::stbi::decode::stbi_image_free(buffer);
 	}
 
 	void Image::save(const char* filename, int quality) const
 	{
+		save(filename, view(), quality);
+	}
+
+	void Image::save(const char* filename, const ImageView<unsigned char>& src, int quality)
+	{
+		if (src.empty()) throw ArgException("Unable to save empty image");
 		std::string ext = fmt::to_lower_ascii(os::path_split_extension(filename));
+		if (ext == "png")
+		{
+			thirdparty::stbi::encode::stbi_write_png(filename, src.cols(), src.rows(), src.channels(), src.ptr(), src.step());
+			return;
+		}
 		if (ext == "jpg" || ext == "jpeg")
 		{
-			thirdparty::jo::jo_write_jpg(filename, (*data_).data(), cols_, rows_, channels_, quality);
+			// encoded in memory and written at once
+			std::vector<unsigned char> buffer;
+			encode_jpeg(src, buffer, quality);
+			std::fstream stream;
+			os::fstream_open(stream, filename, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!stream.is_open()) throw IOException("Unable to open file: " + std::string(filename));
+			stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+			return;
 		}
-		else if (ext == "png")
+
+		// the other writers take packed rows only
+		Image packed;
+		ImageView<unsigned char> pixels = src;
+		if (!src.contiguous())
 		{
-			thirdparty::stbi::encode::stbi_write_png(filename, cols_, rows_, channels_, (*data_).data(), cols_ * channels_);
+			packed.import(src);
+			pixels = packed.view();
 		}
-		else if (ext == "bmp")
+		if (ext == "bmp")
 		{
-			thirdparty::stbi::encode::stbi_write_bmp(filename, cols_, rows_, channels_, (*data_).data());
+			thirdparty::stbi::encode::stbi_write_bmp(filename, pixels.cols(), pixels.rows(), pixels.channels(), pixels.ptr());
 		}
 		else if (ext == "tga")
 		{
-			thirdparty::stbi::encode::stbi_write_tga(filename, cols_, rows_, channels_, (*data_).data());
+			thirdparty::stbi::encode::stbi_write_tga(filename, pixels.cols(), pixels.rows(), pixels.channels(), pixels.ptr());
 		}
 		else
 		{
@@ -13809,30 +15347,695 @@ namespace zz
 		}
 	}
 
-	void Image::resize(int height, int width)
+	void Image::encode_jpeg(std::vector<unsigned char>& out, int quality) const
 	{
-		assert(height > 0 && "height must > 0!");
-		assert(width > 0 && "width must > 0!");
-		range_check(0);
-		detach();
-		std::shared_ptr<std::vector<Image::value_type>> buf = std::make_shared<std::vector<Image::value_type>> (height * width * channels_);
-		thirdparty::stbi::resize::stbir_resize_uint8(&(*data_).front(), cols_, rows_, 0, &(*buf).front(), width, height, 0, channels_);
+		encode_jpeg(view(), out, quality);
+	}
+
+	void Image::encode_png(std::vector<unsigned char>& out) const
+	{
+		encode_png(view(), out);
+	}
+
+	void Image::encode_jpeg(const ImageView<unsigned char>& src, std::vector<unsigned char>& out, int quality)
+	{
+		if (src.empty()) throw ArgException("Unable to encode empty image");
+		out.clear();
+		if (!thirdparty::jo::jo_write_jpg_to_mem(out, src.ptr(), src.cols(), src.rows(), src.channels(), quality, src.step()))
+		{
+			throw RuntimeException("Failed to encode jpeg");
+		}
+	}
+
+	void Image::encode_png(const ImageView<unsigned char>& src, std::vector<unsigned char>& out)
+	{
+		if (src.empty()) throw ArgException("Unable to encode empty image");
+		out.clear();
+		auto append = [](void* context, void* data, int size)
+		{
+			auto bytes = static_cast<const unsigned char*>(data);
+			static_cast<std::vector<unsigned char>*>(context)->insert(
+				static_cast<std::vector<unsigned char>*>(context)->end(), bytes, bytes + size);
+		};
+		if (!thirdparty::stbi::encode::stbi_write_png_to_func(append, &out, src.cols(), src.rows(), src.channels(), src.ptr(), src.step()))
+		{
+			throw RuntimeException("Failed to encode png");
+		}
+	}
+
+	namespace
+	{
+		// Fixed point resize. Weights of both passes are 14 bit and sum to 1 << 14.
+		// The horizontal pass keeps 7 fractional bits in int16 (at most 255 << 7),
+		// so the vertical pass can sum products of pairs with 16 bit multiply-adds.
+		const int kResizeWeightBits = 14;
+		const int kResizeHorzShift = 7;
+		const int kResizeVertShift = 2 * kResizeWeightBits - kResizeHorzShift;
+
+#if defined(STBI_SSE2) || defined(STBI_AVX2)
+		// intrinsics headers are included by the embedded decoder, inside its namespace
+		using namespace thirdparty::stbi::decode;
+#endif
+
+		// Row band parallelism. Output rows are independent given the full image filters,
+		// so bands resized on the pool join into exactly the serial result.
+		const int kResizeMinBandRows = 32;
+		const std::size_t kResizeMinParallelBytes = 1 << 18;
+		std::atomic<int> imageResizeThreads(1);
+		std::mutex resizePoolMutex;
+		std::shared_ptr<cds::ThreadPool> resizePool;
+
+		// run body(first, last) over bands of output rows [0, rows), the caller takes the first band
+		void for_each_row_band(int rows, std::size_t bytes, const std::function<void(int, int)>& body)
+		{
+			int bands = (std::min)(static_cast<int>(imageResizeThreads), rows / kResizeMinBandRows);
+			std::shared_ptr<cds::ThreadPool> pool;
+			if (bands > 1 && bytes >= kResizeMinParallelBytes)
+			{
+				std::lock_guard<std::mutex> lock(resizePoolMutex);
+				pool = resizePool;
+			}
+			if (!pool)
+			{
+				body(0, rows);
+				return;
+			}
+
+			std::vector<std::future<void>> pending;
+			for (int b = 1; b < bands; ++b)
+			{
+				int first = static_cast<int>(static_cast<long long>(rows) * b / bands);
+				int last = static_cast<int>(static_cast<long long>(rows) * (b + 1) / bands);
+				pending.push_back(pool->enqueue([&body, first, last]() { body(first, last); }));
+			}
+			try
+			{
+				body(0, rows / bands);
+			}
+			catch (...)
+			{
+				// tasks reference body, let them finish before unwinding
+				for (auto& f : pending) f.wait();
+				throw;
+			}
+			for (auto& f : pending) f.get();
+		}
+
+		struct ResizeTaps
+		{
+			std::vector<int> begin;		// first tap of each output sample, size + 1 entries
+			std::vector<int> index;		// source sample of each tap
+			std::vector<short> weight;
+			int maxTaps;
+		};
+
+		// taps along one axis, bilinear between the two nearest pixel centers, area
+		// by overlap of pixel spans on a common integer grid
+		void resize_taps(int srcSize, int dstSize, Image::Interp interp, ResizeTaps& taps)
+		{
+			const int one = 1 << kResizeWeightBits;
+			taps.begin.resize(dstSize + 1);
+			taps.index.clear();
+			taps.weight.clear();
+			taps.maxTaps = 1;
+			for (int o = 0; o < dstSize; ++o)
+			{
+				taps.begin[o] = static_cast<int>(taps.index.size());
+				if (interp == Image::Interp::bilinear)
+				{
+					double s = (o + 0.5) * srcSize / dstSize - 0.5;
+					int i0 = static_cast<int>(std::floor(s));
+					int w1 = static_cast<int>((s - i0) * one + 0.5);
+					if (i0 < 0) { i0 = 0; w1 = 0; }
+					if (i0 >= srcSize - 1) { i0 = srcSize - 1; w1 = 0; }
+					taps.index.push_back(i0);
+					taps.weight.push_back(static_cast<short>(one - w1));
+					if (w1 > 0)
+					{
+						taps.index.push_back(i0 + 1);
+						taps.weight.push_back(static_cast<short>(w1));
+					}
+				}
+				else
+				{
+					// destination o spans [o * srcSize, (o + 1) * srcSize), source i spans
+					// [i * dstSize, (i + 1) * dstSize)
+					long long lo = static_cast<long long>(o) * srcSize;
+					long long hi = lo + srcSize;
+					// weights are differences of the rounded covered fraction, so they sum
+					// exactly to one and never go negative, however many sources round to 0.
+					// Zero weights are kept, the vertical ring needs contiguous taps
+					int covered = 0;
+					for (long long i = lo / dstSize; i * dstSize < hi; ++i)
+					{
+						long long end = (std::min)(hi, (i + 1) * dstSize) - lo;
+						int next = static_cast<int>((end * one + srcSize / 2) / srcSize);
+						taps.index.push_back(static_cast<int>(i));
+						taps.weight.push_back(static_cast<short>(next - covered));
+						covered = next;
+					}
+				}
+				int n = static_cast<int>(taps.index.size()) - taps.begin[o];
+				if (n > taps.maxTaps) taps.maxTaps = n;
+			}
+			taps.begin[dstSize] = static_cast<int>(taps.index.size());
+		}
+
+		void resize_horizontal(const unsigned char* src, int channels, const ResizeTaps& taps, int dstCols, short* out)
+		{
+			const int bias = 1 << (kResizeHorzShift - 1);
+			if (channels == 3)
+			{
+				for (int o = 0; o < dstCols; ++o, out += 3)
+				{
+					int s0 = bias, s1 = bias, s2 = bias;
+					for (int t = taps.begin[o]; t < taps.begin[o + 1]; ++t)
+					{
+						const unsigned char* p = src + taps.index[t] * 3;
+						int w = taps.weight[t];
+						s0 += p[0] * w;
+						s1 += p[1] * w;
+						s2 += p[2] * w;
+					}
+					out[0] = static_cast<short>(s0 >> kResizeHorzShift);
+					out[1] = static_cast<short>(s1 >> kResizeHorzShift);
+					out[2] = static_cast<short>(s2 >> kResizeHorzShift);
+				}
+				return;
+			}
+			for (int o = 0; o < dstCols; ++o)
+			{
+				for (int c = 0; c < channels; ++c)
+				{
+					int sum = bias;
+					for (int t = taps.begin[o]; t < taps.begin[o + 1]; ++t)
+					{
+						sum += src[taps.index[t] * channels + c] * taps.weight[t];
+					}
+					*out++ = static_cast<short>(sum >> kResizeHorzShift);
+				}
+			}
+		}
+
+		// out[i] = sum of rows[t][i] * weights[t], descaled and saturated to 8 bit
+		typedef void(*ResizeVerticalKernel)(const short* const* rows, const short* weights, int taps, int n, unsigned char* out);
+
+		void resize_vertical_span(const short* const* rows, const short* weights, int taps, int begin, int end, unsigned char* out)
+		{
+			for (int i = begin; i < end; ++i)
+			{
+				int sum = 1 << (kResizeVertShift - 1);
+				for (int t = 0; t < taps; ++t) sum += rows[t][i] * weights[t];
+				sum >>= kResizeVertShift;
+				out[i] = static_cast<unsigned char>(sum > 255 ? 255 : sum);
+			}
+		}
+
+		void resize_vertical_c(const short* const* rows, const short* weights, int taps, int n, unsigned char* out)
+		{
+			resize_vertical_span(rows, weights, taps, 0, n, out);
+		}
+
+#ifdef STBI_SSE2
+		// 16 outputs per step, taps are consumed in pairs by pmaddwd
+		void resize_vertical_sse2(const short* const* rows, const short* weights, int taps, int n, unsigned char* out)
+		{
+			const __m128i bias = _mm_set1_epi32(1 << (kResizeVertShift - 1));
+			const __m128i zero = _mm_setzero_si128();
+			int i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				__m128i acc0 = bias, acc1 = bias, acc2 = bias, acc3 = bias;
+				for (int t = 0; t < taps; t += 2)
+				{
+					bool pair = t + 1 < taps;
+					__m128i w = _mm_set1_epi32((pair ? weights[t + 1] << 16 : 0) | (weights[t] & 0xffff));
+					__m128i a0 = _mm_loadu_si128((const __m128i*)(rows[t] + i));
+					__m128i a1 = _mm_loadu_si128((const __m128i*)(rows[t] + i + 8));
+					__m128i b0 = pair ? _mm_loadu_si128((const __m128i*)(rows[t + 1] + i)) : zero;
+					__m128i b1 = pair ? _mm_loadu_si128((const __m128i*)(rows[t + 1] + i + 8)) : zero;
+					acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(a0, b0), w));
+					acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(a0, b0), w));
+					acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(a1, b1), w));
+					acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(a1, b1), w));
+				}
+				__m128i lo = _mm_packs_epi32(_mm_srai_epi32(acc0, kResizeVertShift), _mm_srai_epi32(acc1, kResizeVertShift));
+				__m128i hi = _mm_packs_epi32(_mm_srai_epi32(acc2, kResizeVertShift), _mm_srai_epi32(acc3, kResizeVertShift));
+				_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+			}
+			resize_vertical_span(rows, weights, taps, i, n, out);
+		}
+#endif
+
+#ifdef STBI_AVX2
+		// same as sse2 with 32 outputs per step; packs work within 128 bit lanes,
+		// so the final 64 bit quarters are put back in order
+		STBI_AVX2_TARGET
+		void resize_vertical_avx2(const short* const* rows, const short* weights, int taps, int n, unsigned char* out)
+		{
+			const __m256i bias = _mm256_set1_epi32(1 << (kResizeVertShift - 1));
+			const __m256i zero = _mm256_setzero_si256();
+			int i = 0;
+			for (; i + 32 <= n; i += 32)
+			{
+				__m256i acc0 = bias, acc1 = bias, acc2 = bias, acc3 = bias;
+				for (int t = 0; t < taps; t += 2)
+				{
+					bool pair = t + 1 < taps;
+					__m256i w = _mm256_set1_epi32((pair ? weights[t + 1] << 16 : 0) | (weights[t] & 0xffff));
+					__m256i a0 = _mm256_loadu_si256((const __m256i*)(rows[t] + i));
+					__m256i a1 = _mm256_loadu_si256((const __m256i*)(rows[t] + i + 16));
+					__m256i b0 = pair ? _mm256_loadu_si256((const __m256i*)(rows[t + 1] + i)) : zero;
+					__m256i b1 = pair ? _mm256_loadu_si256((const __m256i*)(rows[t + 1] + i + 16)) : zero;
+					acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi16(a0, b0), w));
+					acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi16(a0, b0), w));
+					acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi16(a1, b1), w));
+					acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_unpackhi_epi16(a1, b1), w));
+				}
+				__m256i lo = _mm256_packs_epi32(_mm256_srai_epi32(acc0, kResizeVertShift), _mm256_srai_epi32(acc1, kResizeVertShift));
+				__m256i hi = _mm256_packs_epi32(_mm256_srai_epi32(acc2, kResizeVertShift), _mm256_srai_epi32(acc3, kResizeVertShift));
+				__m256i packed = _mm256_packus_epi16(lo, hi);
+				_mm256_storeu_si256((__m256i*)(out + i), _mm256_permute4x64_epi64(packed, 0xd8));
+			}
+			resize_vertical_span(rows, weights, taps, i, n, out);
+		}
+#endif
+
+		ResizeVerticalKernel resize_vertical_kernel()
+		{
+			static const ResizeVerticalKernel kernel = []() -> ResizeVerticalKernel {
+#ifdef STBI_AVX2
+				if (thirdparty::stbi::decode::stbi__avx2_available()) return resize_vertical_avx2;
+#endif
+#ifdef STBI_SSE2
+				if (thirdparty::stbi::decode::stbi__sse2_available()) return resize_vertical_sse2;
+#endif
+				return resize_vertical_c;
+			}();
+			return kernel;
+		}
+
+		void resize_nearest(const unsigned char* src, int srcCols, int srcRows, int srcStride,
+			unsigned char* dst, int dstCols, int dstRows, int channels, int firstRow, int lastRow)
+		{
+			std::vector<int> offset(dstCols);
+			for (int o = 0; o < dstCols; ++o)
+			{
+				// source pixel whose span contains the destination pixel center
+				offset[o] = static_cast<int>((2LL * o + 1) * srcCols / (2LL * dstCols)) * channels;
+			}
+			for (int r = firstRow; r < lastRow; ++r)
+			{
+				const unsigned char* s = src + static_cast<std::size_t>((2LL * r + 1) * srcRows / (2LL * dstRows)) * srcStride;
+				unsigned char* d = dst + static_cast<std::size_t>(r) * dstCols * channels;
+				if (channels == 3)
+				{
+					for (int o = 0; o < dstCols; ++o, d += 3)
+					{
+						const unsigned char* p = s + offset[o];
+						d[0] = p[0];
+						d[1] = p[1];
+						d[2] = p[2];
+					}
+				}
+				else
+				{
+					for (int o = 0; o < dstCols; ++o, d += channels) std::memcpy(d, s + offset[o], channels);
+				}
+			}
+		}
+
+		// fixed point resize of output rows [firstRow, lastRow), dst points to row 0
+		void resize_fixed_rows(const unsigned char* src, int srcStride, const ResizeTaps& xTaps, const ResizeTaps& yTaps,
+			unsigned char* dst, int dstCols, int channels, int firstRow, int lastRow)
+		{
+			// horizontally resampled source rows, a ring that holds the taps of one output row
+			int rowSize = dstCols * channels;
+			int ringRows = yTaps.maxTaps;
+			std::vector<short> ring(static_cast<std::size_t>(ringRows) * rowSize);
+			std::vector<int> ringSource(ringRows, -1);
+			std::vector<const short*> rows(ringRows);
+			ResizeVerticalKernel vertical = resize_vertical_kernel();
+
+			for (int r = firstRow; r < lastRow; ++r)
+			{
+				int first = yTaps.begin[r];
+				int taps = yTaps.begin[r + 1] - first;
+				for (int t = 0; t < taps; ++t)
+				{
+					int y = yTaps.index[first + t];
+					int slot = y % ringRows;
+					short* line = &ring[static_cast<std::size_t>(slot) * rowSize];
+					if (ringSource[slot] != y)
+					{
+						resize_horizontal(src + static_cast<std::size_t>(y) * srcStride, channels, xTaps, dstCols, line);
+						ringSource[slot] = y;
+					}
+					rows[t] = line;
+				}
+				vertical(rows.data(), &yTaps.weight[first], taps, rowSize, dst + static_cast<std::size_t>(r) * rowSize);
+			}
+		}
+
+		// resize with one of the fixed point modes, src rows are srcStride bytes apart
+		void resize_fixed(const unsigned char* src, int srcCols, int srcRows, int srcStride,
+			unsigned char* dst, int dstCols, int dstRows, int channels, Image::Interp interp)
+		{
+			std::size_t bytes = static_cast<std::size_t>(dstRows) * dstCols * channels;
+			if (interp == Image::Interp::nearest)
+			{
+				for_each_row_band(dstRows, bytes, [&](int firstRow, int lastRow) {
+					resize_nearest(src, srcCols, srcRows, srcStride, dst, dstCols, dstRows, channels, firstRow, lastRow);
+				});
+				return;
+			}
+			ResizeTaps xTaps;
+			ResizeTaps yTaps;
+			resize_taps(srcCols, dstCols, interp, xTaps);
+			resize_taps(srcRows, dstRows, interp, yTaps);
+			for_each_row_band(dstRows, bytes, [&](int firstRow, int lastRow) {
+				resize_fixed_rows(src, srcStride, xTaps, yTaps, dst, dstCols, channels, firstRow, lastRow);
+			});
+		}
+
+		// stbir filtered resize of 8 bit or float pixels, bands share the full image filters
+		void resize_filter(const void* src, int srcCols, int srcRows, int srcStride, void* dst, int dstCols, int dstRows,
+			int channels, thirdparty::stbi::resize::stbir_datatype type, std::size_t pixelSize)
+		{
+			std::size_t rowBytes = static_cast<std::size_t>(dstCols) * channels * pixelSize;
+			for_each_row_band(dstRows, rowBytes * dstRows, [&](int firstRow, int lastRow) {
+				thirdparty::stbi::resize::stbir_resize_rows(src, srcCols, srcRows, srcStride,
+					static_cast<unsigned char*>(dst) + rowBytes * firstRow, dstCols, dstRows, 0, type, channels, firstRow, lastRow);
+			});
+		}
+	}
+
+	void Image::set_resize_threads(int threads)
+	{
+		threads = threads > 0 ? threads : 1;
+		std::lock_guard<std::mutex> lock(resizePoolMutex);
+		// the caller resizes one band itself
+		resizePool = threads > 1 ? std::make_shared<cds::ThreadPool>(threads - 1) : nullptr;
+		imageResizeThreads = threads;
+	}
+
+	void Image::resize(int height, int width, Interp interp)
+	{
+		assert(height > 0 && "height must > 0!");
+		assert(width > 0 && "width must > 0!");
+		range_check(0);
+		// old buffer is only read, shared copies stay valid, no need to detach
+		std::shared_ptr<Image::storage_type> buf = std::make_shared<Image::storage_type>(height * width * channels_);
+		if (interp == Interp::filter)
+		{
+			resize_filter(&(*data_).front(), cols_, rows_, 0, &(*buf).front(), width, height, channels_,
+				thirdparty::stbi::resize::STBIR_TYPE_UINT8, sizeof(Image::value_type));
+		}
+		else
+		{
+			resize_fixed(&(*data_).front(), cols_, rows_, cols_ * channels_, &(*buf).front(), width, height, channels_, interp);
+		}
 		data_ = buf;
 		rows_ = height;
 		cols_ = width;
 	}
 
-	void Image::resize(double ratio)
+	void Image::resize(double ratio, Interp interp)
 	{
 		assert(ratio > 0 && "resize ratio must > 0!");
 		int width = static_cast<int>(cols_ * ratio);
 		int height = static_cast<int>(rows_ * ratio);
-		resize(height, width);
+		resize(height, width, interp);
 	}
 
-	void Image::resize(Size sz)
+	void Image::resize(Size sz, Interp interp)
 	{
-		resize(sz.height, sz.width);
+		resize(sz.height, sz.width, interp);
+	}
+
+	void Image::resize_from(const Image& src, Rect roi, int height, int width, Interp interp)
+	{
+		if (roi.x < 0 || roi.y < 0 || roi.width < 1 || roi.height < 1
+			|| roi.x + roi.width > src.cols() || roi.y + roi.height > src.rows())
+		{
+			throw ArgException("Resize region out of source image!");
+		}
+		resize_from(src.view(roi), height, width, interp);
+	}
+
+	void Image::resize_from(const ImageView<unsigned char>& src, int height, int width, Interp interp)
+	{
+		assert(height > 0 && "height must > 0!");
+		assert(width > 0 && "width must > 0!");
+		if (src.empty()) throw ArgException("Unable to resize empty image");
+		int channels = src.channels();
+		// src may be a view of this image, it stays alive until the new buffer is swapped in
+		std::shared_ptr<Image::storage_type> buf = std::make_shared<Image::storage_type>(height * width * channels);
+		if (interp == Interp::filter)
+		{
+			resize_filter(src.ptr(), src.cols(), src.rows(), src.step(),
+				&(*buf).front(), width, height, channels, thirdparty::stbi::resize::STBIR_TYPE_UINT8, sizeof(Image::value_type));
+		}
+		else
+		{
+			resize_fixed(src.ptr(), src.cols(), src.rows(), src.step(),
+				&(*buf).front(), width, height, channels, interp);
+		}
+		data_ = buf;
+		rows_ = height;
+		cols_ = width;
+		channels_ = channels;
+	}
+
+	namespace
+	{
+#ifdef STBI_SSE2
+		using namespace thirdparty::stbi::decode;
+#endif
+
+		// converts n pixels of a row, background is RGB, src may equal dst for swaps
+		typedef void(*ConvertKernel)(const unsigned char* src, unsigned char* dst, int n, const unsigned char* bg);
+
+		void convert_gray2rgb_c(const unsigned char* src, unsigned char* dst, int n, const unsigned char*)
+		{
+			for (int i = 0; i < n; ++i, dst += 3)
+			{
+				dst[0] = dst[1] = dst[2] = src[i];
+			}
+		}
+
+		void convert_rgba2rgb_c(const unsigned char* src, unsigned char* dst, int n, const unsigned char*)
+		{
+			for (int i = 0; i < n; ++i, src += 4, dst += 3)
+			{
+				dst[0] = src[0];
+				dst[1] = src[1];
+				dst[2] = src[2];
+			}
+		}
+
+		// c * a + bg * (255 - a), divided by 255 with rounding
+		void convert_rgba_over_c(const unsigned char* src, unsigned char* dst, int n, const unsigned char* bg)
+		{
+			for (int i = 0; i < n; ++i, src += 4, dst += 3)
+			{
+				int a = src[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					int t = src[k] * a + bg[k] * (255 - a) + 128;
+					dst[k] = static_cast<unsigned char>((t + (t >> 8)) >> 8);
+				}
+			}
+		}
+
+		void convert_swap_rb_c(const unsigned char* src, unsigned char* dst, int n, const unsigned char*)
+		{
+			for (int i = 0; i < n; ++i, src += 3, dst += 3)
+			{
+				unsigned char r = src[0];
+				dst[1] = src[1];
+				dst[0] = src[2];
+				dst[2] = r;
+			}
+		}
+
+#ifdef STBI_SSE2
+		// drop the fourth byte of four 4 byte pixels, result in the low 12 bytes
+		inline __m128i convert_pack3_sse2(__m128i x)
+		{
+			const __m128i lo3 = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+			const __m128i hi3 = _mm_set_epi32(0x00ffffff, 0, 0x00ffffff, 0);
+			const __m128i lane0 = _mm_set_epi32(0, 0, -1, -1);
+			__m128i q = _mm_or_si128(_mm_and_si128(x, lo3), _mm_srli_epi64(_mm_and_si128(x, hi3), 8));
+			return _mm_or_si128(_mm_and_si128(q, lane0), _mm_srli_si128(_mm_andnot_si128(lane0, q), 2));
+		}
+
+		inline void convert_store12_sse2(unsigned char* dst, __m128i v)
+		{
+			_mm_storel_epi64((__m128i*)dst, v);
+			int tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+			std::memcpy(dst + 8, &tail, 4);
+		}
+
+		void convert_gray2rgb_sse2(const unsigned char* src, unsigned char* dst, int n, const unsigned char* bg)
+		{
+			int i = 0;
+			for (; i + 16 <= n; i += 16, dst += 48)
+			{
+				__m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+				__m128i lo = _mm_unpacklo_epi8(g, g);
+				__m128i hi = _mm_unpackhi_epi8(g, g);
+				convert_store12_sse2(dst, convert_pack3_sse2(_mm_unpacklo_epi16(lo, lo)));
+				convert_store12_sse2(dst + 12, convert_pack3_sse2(_mm_unpackhi_epi16(lo, lo)));
+				convert_store12_sse2(dst + 24, convert_pack3_sse2(_mm_unpacklo_epi16(hi, hi)));
+				convert_store12_sse2(dst + 36, convert_pack3_sse2(_mm_unpackhi_epi16(hi, hi)));
+			}
+			convert_gray2rgb_c(src + i, dst, n - i, bg);
+		}
+
+		void convert_rgba2rgb_sse2(const unsigned char* src, unsigned char* dst, int n, const unsigned char* bg)
+		{
+			int i = 0;
+			for (; i + 4 <= n; i += 4, src += 16, dst += 12)
+			{
+				convert_store12_sse2(dst, convert_pack3_sse2(_mm_loadu_si128((const __m128i*)src)));
+			}
+			convert_rgba2rgb_c(src, dst, n - i, bg);
+		}
+
+		void convert_rgba_over_sse2(const unsigned char* src, unsigned char* dst, int n, const unsigned char* bg)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i full = _mm_set1_epi16(255);
+			const __m128i half = _mm_set1_epi16(128);
+			const __m128i color = _mm_set_epi16(0, bg[2], bg[1], bg[0], 0, bg[2], bg[1], bg[0]);
+			int i = 0;
+			for (; i + 4 <= n; i += 4, src += 16, dst += 12)
+			{
+				__m128i x = _mm_loadu_si128((const __m128i*)src);
+				__m128i c[2] = { _mm_unpacklo_epi8(x, zero), _mm_unpackhi_epi8(x, zero) };
+				for (int h = 0; h < 2; ++h)
+				{
+					// alpha of each of the two pixels into all of its lanes, sums stay below 2^16
+					__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c[h], 0xff), 0xff);
+					__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(c[h], a),
+						_mm_mullo_epi16(color, _mm_sub_epi16(full, a))), half);
+					c[h] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+				}
+				convert_store12_sse2(dst, convert_pack3_sse2(_mm_packus_epi16(c[0], c[1])));
+			}
+			convert_rgba_over_c(src, dst, n - i, bg);
+		}
+
+		// 16 pixels per step, byte j takes byte j + 2, j or j - 2 by j % 3. All three
+		// vectors are loaded before storing, so it works in place
+		void convert_swap_rb_sse2(const unsigned char* src, unsigned char* dst, int n, const unsigned char* bg)
+		{
+			static const struct SwapMasks
+			{
+				__m128i next[3], keep[3], prev[3];
+				SwapMasks()
+				{
+					for (int k = 0; k < 3; ++k)
+					{
+						unsigned char m[3][16];
+						for (int j = 0; j < 16; ++j)
+						{
+							int mod = (16 * k + j) % 3;
+							for (int c = 0; c < 3; ++c) m[c][j] = mod == c ? 0xff : 0;
+						}
+						next[k] = _mm_loadu_si128((const __m128i*)m[0]);
+						keep[k] = _mm_loadu_si128((const __m128i*)m[1]);
+						prev[k] = _mm_loadu_si128((const __m128i*)m[2]);
+					}
+				}
+			} masks;
+			int i = 0;
+			for (; i + 16 <= n; i += 16, src += 48, dst += 48)
+			{
+				__m128i v[3];
+				for (int k = 0; k < 3; ++k) v[k] = _mm_loadu_si128((const __m128i*)(src + 16 * k));
+				__m128i out[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					__m128i next = _mm_srli_si128(v[k], 2);
+					if (k < 2) next = _mm_or_si128(next, _mm_slli_si128(v[k + 1], 14));
+					__m128i prev = _mm_slli_si128(v[k], 2);
+					if (k > 0) prev = _mm_or_si128(prev, _mm_srli_si128(v[k - 1], 14));
+					out[k] = _mm_or_si128(_mm_and_si128(v[k], masks.keep[k]),
+						_mm_or_si128(_mm_and_si128(next, masks.next[k]), _mm_and_si128(prev, masks.prev[k])));
+				}
+				for (int k = 0; k < 3; ++k) _mm_storeu_si128((__m128i*)(dst + 16 * k), out[k]);
+			}
+			convert_swap_rb_c(src, dst, n - i, bg);
+		}
+#endif
+
+		int convert_channels(Image::Convert code)
+		{
+			if (code == Image::Convert::gray2rgb) return 1;
+			if (code == Image::Convert::rgba2rgb) return 4;
+			return 3;
+		}
+
+		ConvertKernel convert_kernel(Image::Convert code, bool blend)
+		{
+#ifdef STBI_SSE2
+			static const bool sse2 = thirdparty::stbi::decode::stbi__sse2_available() != 0;
+			if (sse2)
+			{
+				if (code == Image::Convert::gray2rgb) return convert_gray2rgb_sse2;
+				if (code == Image::Convert::rgba2rgb) return blend ? convert_rgba_over_sse2 : convert_rgba2rgb_sse2;
+				return convert_swap_rb_sse2;
+			}
+#endif
+			if (code == Image::Convert::gray2rgb) return convert_gray2rgb_c;
+			if (code == Image::Convert::rgba2rgb) return blend ? convert_rgba_over_c : convert_rgba2rgb_c;
+			return convert_swap_rb_c;
+		}
+	}
+
+	void Image::convert_from(const ImageView<unsigned char>& src, Convert code, const unsigned char* background)
+	{
+		if (src.empty()) throw ArgException("Unable to convert empty image");
+		if (src.channels() != convert_channels(code))
+		{
+			throw ArgException("Image has " + std::to_string(src.channels()) + " channels, conversion needs "
+				+ std::to_string(convert_channels(code)));
+		}
+		ConvertKernel kernel = convert_kernel(code, background != nullptr);
+		int rows = src.rows();
+		int cols = src.cols();
+		// src may be a view of this image, it stays alive until the new buffer is swapped in
+		std::shared_ptr<Image::storage_type> buf = std::make_shared<Image::storage_type>(rows * cols * 3);
+		unsigned char* dst = &(*buf).front();
+		for (int r = 0; r < rows; ++r)
+		{
+			kernel(src.ptr(r), dst + static_cast<std::size_t>(r) * cols * 3, cols, background);
+		}
+		data_ = buf;
+		rows_ = rows;
+		cols_ = cols;
+		channels_ = 3;
+	}
+
+	void Image::convert(Convert code, const unsigned char* background)
+	{
+		bool swap = code == Convert::bgr2rgb || code == Convert::rgb2bgr;
+		if (swap && channels_ == 3 && data_ && data_.use_count() < 2)
+		{
+			// sole owner, swap in place without a second buffer
+			ConvertKernel kernel = convert_kernel(code, false);
+			kernel(ptr(), ptr(), rows_ * cols_, nullptr);
+			return;
+		}
+		convert_from(view(), code, background);
+	}
+
+	void Image::to_rgb(const unsigned char* background)
+	{
+		if (channels_ == 1) convert(Convert::gray2rgb, background);
+		else if (channels_ == 4) convert(Convert::rgba2rgb, background);
 	}
 
 	ImageHdr::ImageHdr(const char* filename)
@@ -13890,14 +16093,15 @@ namespace zz
 		}
 	}
 
-	void ImageHdr::resize(int width, int height)
+	void ImageHdr::resize(int height, int width)
 	{
 		assert(height > 0 && "height must > 0!");
 		assert(width > 0 && "width must > 0!");
 		range_check(0);
-		detach();
-		std::shared_ptr<std::vector<ImageHdr::value_type>> buf = std::make_shared<std::vector<ImageHdr::value_type>>(height * width * channels_);
-		thirdparty::stbi::resize::stbir_resize_float(&(*data_).front(), cols_, rows_, 0, &(*buf).front(), width, height, 0, channels_);
+		// old buffer is only read, shared copies stay valid, no need to detach
+		std::shared_ptr<ImageHdr::storage_type> buf = std::make_shared<ImageHdr::storage_type>(height * width * channels_);
+		resize_filter(&(*data_).front(), cols_, rows_, 0, &(*buf).front(), width, height, channels_,
+			thirdparty::stbi::resize::STBIR_TYPE_FLOAT, sizeof(ImageHdr::value_type));
 		data_ = buf;
 		rows_ = height;
 		cols_ = width;